@@ -0,0 +1,184 @@
+/*#-------------------------------------------------
+#
+#                 Labels model
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * Labels list : id, name and gray gradient of each label
+#
+# * No limit on the number of labels
+#
+# * Gradient parameters stored in one array per field
+#
+# * Label id <-> list row index
+#
+# * Qt list model : shown by a QListView, only visible rows are drawn
+#
+#-------------------------------------------------*/
+
+#include <algorithm>
+
+#include "labelsmodel.h"
+
+///////////////////////////////////////////////
+//// Qt model
+///////////////////////////////////////////////
+
+labelsModel::labelsModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+    minId = 0;
+}
+
+int labelsModel::rowCount(const QModelIndex &parent) const // number of labels
+{
+    if (parent.isValid()) // a list has no children
+        return 0;
+
+    return int(ids.size());
+}
+
+QVariant labelsModel::data(const QModelIndex &index, int role) const // name for display, id for Qt::UserRole
+{
+    if ((!index.isValid()) || (index.row() < 0) || (index.row() >= int(ids.size()))) // not a label
+        return QVariant();
+
+    switch (role) {
+        case Qt::DisplayRole: return names[index.row()]; // label name
+        case Qt::UserRole: return ids[index.row()]; // label id
+    }
+
+    return QVariant();
+}
+
+///////////////////////////////////////////////
+//// Loading
+///////////////////////////////////////////////
+
+void labelsModel::Clear() // delete all labels
+{
+    BeginLoad();
+    EndLoad();
+}
+
+void labelsModel::BeginLoad(const int &count) // before adding labels with Append
+{
+    beginResetModel(); // views forget everything until EndLoad
+
+    ids.clear();
+    names.clear();
+    gradientTypes.clear();
+    curves.clear();
+    beginColors.clear();
+    endColors.clear();
+    beginPoints.clear();
+    endPoints.clear();
+
+    ids.reserve(count); // no reallocation while loading
+    names.reserve(count);
+    gradientTypes.reserve(count);
+    curves.reserve(count);
+    beginColors.reserve(count);
+    endColors.reserve(count);
+    beginPoints.reserve(count);
+    endPoints.reserve(count);
+}
+
+void labelsModel::Append(const int &id, const QString &name, const grayGradient &gradient) // add a label at the end of the list
+{
+    ids.push_back(id);
+    names.push_back(name);
+    gradientTypes.push_back(gradient.gradient);
+    curves.push_back(gradient.curve);
+    beginColors.push_back(gradient.beginColor);
+    endColors.push_back(gradient.endColor);
+    beginPoints.push_back(gradient.beginPoint);
+    endPoints.push_back(gradient.endPoint);
+}
+
+void labelsModel::EndLoad() // after the last Append
+{
+    IndexRows(); // label id -> row
+    endResetModel(); // views can show the new labels
+}
+
+///////////////////////////////////////////////
+//// Access
+///////////////////////////////////////////////
+
+void labelsModel::IndexRows() // build the label id -> row index
+{
+    rows.clear();
+    rowsSparse.clear();
+    minId = 0;
+    if (ids.empty())
+        return;
+
+    minId = *std::min_element(ids.begin(), ids.end()); // range of label ids
+    int64 range = int64(*std::max_element(ids.begin(), ids.end())) - minId + 1;
+
+    if (range <= 4 * int64(ids.size()) + 1024) { // compact ids : dense array
+        rows.assign(range, -1);
+        for (int row = int(ids.size()) - 1; row >= 0; row--) // if an id is used twice the first row wins
+            rows[ids[row] - minId] = row;
+    }
+    else // very spread ids : hash table
+        for (int row = int(ids.size()) - 1; row >= 0; row--)
+            rowsSparse[ids[row]] = row;
+}
+
+int labelsModel::Row(const int &id) const // row of a label id, -1 if not found
+{
+    if (!rows.empty()) { // dense array
+        int64 index = int64(id) - minId;
+        if ((index < 0) || (index >= int64(rows.size())))
+            return -1;
+        return rows[index];
+    }
+
+    std::unordered_map<int, int>::const_iterator found = rowsSparse.find(id);
+    return (found != rowsSparse.end()) ? found->second : -1;
+}
+
+grayGradient labelsModel::Gradient(const int &row) const // gradient of a row
+{
+    grayGradient gradient;
+    if (!IsRow(row)) { // no label : flat black
+        gradient.gradient = gradient_flat;
+        gradient.curve = curve_linear;
+        gradient.beginColor = 0;
+        gradient.endColor = 0;
+        return gradient;
+    }
+
+    gradient.gradient = gradientTypes[row];
+    gradient.curve = curves[row];
+    gradient.beginColor = beginColors[row];
+    gradient.endColor = endColors[row];
+    gradient.beginPoint = beginPoints[row];
+    gradient.endPoint = endPoints[row];
+
+    return gradient;
+}
+
+std::vector<grayGradient> labelsModel::Gradients() const // gradients of all rows
+{
+    std::vector<grayGradient> gradients(ids.size());
+    for (size_t row = 0; row < ids.size(); row++)
+        gradients[row] = Gradient(int(row));
+
+    return gradients;
+}
+
+void labelsModel::SetGradient(const int &row, const grayGradient &gradient) // change all the gradient of a row
+{
+    if (!IsRow(row)) // not a label
+        return;
+
+    gradientTypes[row] = gradient.gradient;
+    curves[row] = gradient.curve;
+    beginColors[row] = gradient.beginColor;
+    endColors[row] = gradient.endColor;
+    beginPoints[row] = gradient.beginPoint;
+    endPoints[row] = gradient.endPoint;
+}
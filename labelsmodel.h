@@ -0,0 +1,84 @@
+/*#-------------------------------------------------
+#
+#                 Labels model
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * Labels list : id, name and gray gradient of each label
+#
+# * No limit on the number of labels
+#
+# * Gradient parameters stored in one array per field
+#
+# * Label id <-> list row index
+#
+# * Qt list model : shown by a QListView, only visible rows are drawn
+#
+#-------------------------------------------------*/
+
+#ifndef LABELSMODEL_H
+#define LABELSMODEL_H
+
+#include <QAbstractListModel>
+#include <QString>
+#include <vector>
+#include <unordered_map>
+
+#include "opencv2/opencv.hpp"
+
+#include "mat-image-tools.h"
+
+class labelsModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit labelsModel(QObject *parent = 0);
+
+    // Qt model
+    int rowCount(const QModelIndex &parent = QModelIndex()) const; // number of labels
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const; // name for display, id for Qt::UserRole
+
+    // loading
+    void Clear(); // delete all labels
+    void BeginLoad(const int &count = 0); // before adding labels with Append - count = expected number of labels
+    void Append(const int &id, const QString &name, const grayGradient &gradient); // add a label at the end of the list
+    void EndLoad(); // after the last Append : views are updated and the id index is built
+
+    // access
+    int Count() const { return int(ids.size()); } // number of labels
+    int Id(const int &row) const { return ids[row]; } // label id of a row
+    int Row(const int &id) const; // row of a label id, -1 if not found
+    const std::vector<int>& Ids() const { return ids; } // label ids of all rows
+    QString Name(const int &row) const { return names[row]; } // label name of a row
+
+    // gradients - a row outside the list (no current label) gives a flat black gradient and can't be changed
+    bool IsRow(const int &row) const { return (row >= 0) && (row < int(ids.size())); } // is it a row of the list ?
+    grayGradient Gradient(const int &row) const; // gradient of a row
+    std::vector<grayGradient> Gradients() const; // gradients of all rows
+    void SetGradient(const int &row, const grayGradient &gradient); // change all the gradient of a row
+    void SetGradientType(const int &row, const gradientType &type) { if (IsRow(row)) gradientTypes[row] = type; } // change one field of the gradient of a row
+    void SetCurve(const int &row, const curveType &curve) { if (IsRow(row)) curves[row] = curve; }
+    void SetBeginColor(const int &row, const int &color) { if (IsRow(row)) beginColors[row] = color; }
+    void SetEndColor(const int &row, const int &color) { if (IsRow(row)) endColors[row] = color; }
+    void SetBeginPoint(const int &row, const cv::Point &point) { if (IsRow(row)) beginPoints[row] = point; }
+    void SetEndPoint(const int &row, const cv::Point &point) { if (IsRow(row)) endPoints[row] = point; }
+
+private:
+    void IndexRows(); // build the label id -> row index
+
+    // one array per field, indexed on rows
+    std::vector<int> ids; // label ids
+    std::vector<QString> names; // label names
+    std::vector<gradientType> gradientTypes; // gradient types
+    std::vector<curveType> curves; // gray curves
+    std::vector<int> beginColors, endColors; // gray levels
+    std::vector<cv::Point> beginPoints, endPoints; // gradient vectors
+
+    // label id -> row
+    std::vector<int> rows; // label id - minId -> row, -1 = no row : ids are compact so an array is enough
+    std::unordered_map<int, int> rowsSparse; // label id -> row, only used if ids are too spread for an array
+    int minId; // label id of rows[0]
+};
+
+#endif // LABELSMODEL_H
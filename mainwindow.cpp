@@ -19,6 +19,11 @@
 #include <QSizeGrip>
 #include <QGridLayout>
 #include <QDesktopWidget>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QSaveFile>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QFileInfo>
 
 #include "mat-image-tools.h"
 #include "dispersion3D.h"
@@ -73,6 +78,12 @@ MainWindow::MainWindow(QWidget *parent) :
     AddCurveItem("UNDULATE+",   QColor(128,0,0),    "Increasing levels of gray stripes\n    f(x)=f(x) = cos(pi²∙(x+2.085)²) / ((x+2.085)³+10) + (x+2.085) − 2.11");
     ui->listWidget_gradient_curve->blockSignals(false);
 
+    // labels list : the view only draws the visible rows of the model
+    ui->listView_labels->setModel(&labelsList);
+    ui->listView_labels->setUniformItemSizes(true); // no need to compute each row height
+    connect(ui->listView_labels->selectionModel(), SIGNAL(currentChanged(QModelIndex,QModelIndex)),
+            this, SLOT(CurrentLabelChanged(QModelIndex)));
+
     // populate tints comboBox
     ui->comboBox_3d_tint->addItem(QIcon(":/icons/color.png"), "Color");
     ui->comboBox_3d_tint->addItem(QIcon(":/icons/gray.png"), "Gray");
@@ -85,12 +96,46 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->frame_gradient->setEnabled(false); // only enabled when a segmentation or depthmap XML file is loaded
     ui->spinBox_3d_resolution->setValue(ui->openGLWidget_3d->width()); // default size openGL widget
 
+    // gradient updates while dragging handles
+    gradientTimer.setSingleShot(true);
+    gradientTimer.setInterval(16); // at most one update per display frame (60 Hz)
+    connect(&gradientTimer, SIGNAL(timeout()), this, SLOT(FlushLabelGradient()));
+    gradientPending = false;
+
+    // depthmap edits and 3D blur computed by a worker thread
+    connect(&depthmapWatcher, SIGNAL(finished()), this, SLOT(DepthmapJobFinished()));
+    connect(&blurWatcher, SIGNAL(finished()), this, SLOT(BlurJobFinished()));
+    depthmapJobRunning = false;
+    dirtyLabel3D = -1;
+    label3D = -1;
+    blurPending = false;
+    blurJobRunning = false;
+    depthmapVersion = 0;
+    blurVersion3D = -1;
+    blurSize3D = 0;
+    labelShapesCancel = false;
+
+    // sessions saved by a worker thread
+    saveProgress = new QProgressDialog("Saving depthmap session...", QString(), 0, 8, this); // no cancel button, 8 steps : 4 files encoded then written
+    saveProgress->setWindowModality(Qt::NonModal); // editing goes on while saving
+    saveProgress->setMinimumDuration(500); // only shown for long saves
+    saveProgress->reset(); // hidden until the first save
+    connect(&saveWatcher, SIGNAL(finished()), this, SLOT(SaveSessionFinished()));
+    saveDepthmapData = NULL;
+    saveFormatUsed = save_png;
+    journalRecords = 0;
+
+    // adaptive 3D mesh quality
+    connect(ui->openGLWidget_3d, SIGNAL(meshChanged(int,double)), this, SLOT(ShowMesh3D(int,double)));
+
     // initial variable values
     InitializeValues();
 }
 
 MainWindow::~MainWindow()
 {
+    ResetLabelShapes(); // stop the worker before labels are destroyed
+    saveWatcher.waitForFinished(); // don't leave a session half-written
     delete ui;
 }
 
@@ -127,7 +172,6 @@ void MainWindow::InitializeValues() // Global variables init
     ui->openGLWidget_3d->image3D = image; // transfer data to widget
     ui->openGLWidget_3d->depthmap3D = depthmap;
     ui->openGLWidget_3d->area3D = Rect(0, 0, image.cols,image.rows);
-    ui->openGLWidget_3d->mask3D = Mat::zeros(image.rows, image.cols, CV_8UC1);
     ui->openGLWidget_3d->depth3D = 1; // initial view
     ui->openGLWidget_3d->anaglyphShift = -1.5;
     ui->openGLWidget_3d->computeVertices3D = true; // recompute 3D vertices
@@ -147,16 +191,26 @@ void MainWindow::on_button_quit_clicked()
 
 ///////////////////    Labels     //////////////////////
 
-int MainWindow::GetCurrentLabelNumber() // label number for use with "label" mask
+void MainWindow::DeleteAllLabels() // delete all labels in the list
 {
-    return ui->listWidget_labels->currentItem()->data(Qt::UserRole).toInt(); // label number stored in this special field
+    BlockLabelsSignals(true); // the labels list must not trigger any action
+    labelsList.Clear(); // delete all labels
+    BlockLabelsSignals(false); // return to normal
 }
 
-void MainWindow::DeleteAllLabels() // delete all labels in the list
+int MainWindow::CurrentLabelRow() // row of current label in the list, -1 if none
 {
-    ui->listWidget_labels->blockSignals(true); // the labels list must not trigger any action
-    ui->listWidget_labels->clear(); // delete all labels
-    ui->listWidget_labels->blockSignals(false); // return to normal
+    return ui->listView_labels->currentIndex().row();
+}
+
+void MainWindow::SetCurrentLabelRow(const int &row) // change current label, it triggers CurrentLabelChanged
+{
+    ui->listView_labels->setCurrentIndex(labelsList.index(row));
+}
+
+void MainWindow::BlockLabelsSignals(const bool &active) // block or not the current label signal
+{
+    ui->listView_labels->selectionModel()->blockSignals(active);
 }
 
 void MainWindow::BlockGradientsSignals(const bool &active) // block or not all gradient elements signals
@@ -172,47 +226,39 @@ void MainWindow::BlockGradientsSignals(const bool &active) // block or not all g
     ui->listWidget_gradient_curve->blockSignals(active);
 }
 
-void MainWindow::on_listWidget_labels_currentItemChanged(QListWidgetItem *currentItem) // several actions when label changes
+void MainWindow::CurrentLabelChanged(const QModelIndex &current) // several actions when label changes
 {
-    ui->label_name->setText(currentItem->text()); // display label name as current
+    if (!current.isValid()) // no label
+        return;
 
-    int id = currentItem->data(Qt::UserRole).toInt(); // get label id
-    currentLabelMask = labels == id; // extract label using its id
-    selection = 0; // erase selection mask
-    //selection.setTo(Vec3b(0, 32, 32), mask_temp); // fill with dark yellow
+    int row = current.row(); // get current row of the list to access arrays indexed on it
+    ui->label_name->setText(labelsList.Name(row)); // display label name as current
 
-    vector<vector<cv::Point>> contours;
-    vector<Vec4i> hierarchy;
-    findContours(currentLabelMask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE); // find new cell contours
+    int id = labelsList.Id(row); // get label id
+    labelRunsIndex::const_iterator found = labelsRuns.find(id); // runs of pixels of this label
+    if (found != labelsRuns.end())
+        currentLabelRuns = found->second;
+    else // label not in image
+        currentLabelRuns.clear();
 
-    selection_rect = boundingRect(contours[0]); // find biggest rectangle
-    for (uint n = 1; n < contours.size(); n++) { // ... by cycling through all found contours
-        Rect rect_temp = boundingRect(contours[n]); // current Rect
-        if (rect_temp.x < selection_rect.x) { // adjust size
-            selection_rect.width += selection_rect.x - rect_temp.x;
-            selection_rect.x = rect_temp.x;
-        }
-        if (rect_temp.y < selection_rect.y) {
-            selection_rect.height += selection_rect.y - rect_temp.y;
-            selection_rect.y = rect_temp.y;
-        }
-        if (rect_temp.x + rect_temp.width > selection_rect.x + selection_rect.width)
-            selection_rect.width = rect_temp.x + rect_temp.width - selection_rect.x;
-        if (rect_temp.y + rect_temp.height > selection_rect.y + selection_rect.height)
-            selection_rect.height = rect_temp.y + rect_temp.height - selection_rect.y;
-    }
-    ui->openGLWidget_3d->area3D = selection_rect; // update opengl widget elements
-    ui->openGLWidget_3d->mask3D = currentLabelMask;
+    Rect erase = selection_rect & Rect(0, 0, selection.cols, selection.rows); // only the previous contour is in the selection mask
+    if (erase.area() > 0)
+        selection(erase) = 0; // erase it
+    //selection.setTo(Vec3b(0, 32, 32), mask_temp); // fill with dark yellow
+
+    labelShape shape = GetLabelShape(id); // mask and contours of the label
+    selection_rect = shape.bounds; // rectangle containing the label
 
-    drawContours(selection, contours, -1, Vec3b(0, 255, 255), 1, 8, hierarchy ); // draw contour of new cell in selection mask
+    if (!shape.contours.empty()) // draw contour of new cell in selection mask
+        drawContours(selection, shape.contours, -1, Vec3b(0, 255, 255), 1, 8);
     /*cv::rectangle(selection, Rect(selection_rect.x, selection_rect.y, selection_rect.width, selection_rect.height),
                           Vec3b(255, 255, 255), 2); // draw entire selection rectangle*/
 
     BlockGradientsSignals(true); // don't trigger automatic actions for these widgets
 
-    int row = ui->listWidget_labels->currentRow(); // get current row of the list to access array indexed on it
+    grayGradient gradient = labelsList.Gradient(row); // gradient of current label
 
-    switch (gradients[row].gradient) { // gradient type ?
+    switch (gradient.gradient) { // gradient type ?
         case gradient_flat: {
             ui->radioButton_flat->setChecked(true); // set correspondng radio button
             break;
@@ -231,11 +277,11 @@ void MainWindow::on_listWidget_labels_currentItemChanged(QListWidgetItem *curren
         }
     }
 
-    ui->horizontalSlider_begin->setValue(gradients[row].beginColor); // show begin and end colors
-    ui->horizontalSlider_end->setValue(gradients[row].endColor);
-    ui->spinBox_color_begin->setValue(gradients[row].beginColor);
-    ui->spinBox_color_end->setValue(gradients[row].endColor);
-    ui->listWidget_gradient_curve->setCurrentRow(gradients[row].curve); // and the gray gradient curve type
+    ui->horizontalSlider_begin->setValue(gradient.beginColor); // show begin and end colors
+    ui->horizontalSlider_end->setValue(gradient.endColor);
+    ui->spinBox_color_begin->setValue(gradient.beginColor);
+    ui->spinBox_color_end->setValue(gradient.endColor);
+    ui->listWidget_gradient_curve->setCurrentRow(gradient.curve); // and the gray gradient curve type
 
     BlockGradientsSignals(false); // signals : return to normal
 
@@ -273,12 +319,16 @@ void MainWindow::ChangeBaseDir(QString filename) // Set base dir and file
 void MainWindow::DisableGUI() // reset entire GUI - used when something goes wrong when loading files
 {
     loaded = false;
+    ResetDepthmapJobs(); // forget edits of the old depthmap
     ui->label_viewport->setPixmap(QPixmap());
     ui->label_thumbnail->setPixmap(QPixmap());
     ui->frame_gradient->setEnabled(false);
     image.release();
     depthmap.release();
     labels.release();
+    ResetLabelShapes(); // before labels change
+    labelsRuns.clear();
+    currentLabelRuns.clear();
     ui->openGLWidget_3d->image3D.release();
     ui->openGLWidget_3d->depthmap3D.release();
     ui->openGLWidget_3d->computeVertices3D = true;
@@ -286,6 +336,8 @@ void MainWindow::DisableGUI() // reset entire GUI - used when something goes wro
     ui->openGLWidget_3d->update();
     DeleteAllLabels(); // delete all labels but do not create a new one
     ui->label_filename->setText("Please load a file"); // delete file name in ui
+    CloseJournal(); // no session
+    imageFile.clear();
     QApplication::restoreOverrideCursor(); // Restore cursor
 }
 
@@ -296,8 +348,7 @@ void MainWindow::on_button_load_segmentation_clicked() // load segmentation XML
     if (filename.isNull() || filename.isEmpty()) // cancel ?
         return;
 
-    QApplication::setOverrideCursor(Qt::WaitCursor); // wait cursor
-    qApp->processEvents();
+    ResetDepthmapJobs(); // depthmap is going to be replaced
 
     /*basefile = filename.toUtf8().constData(); // base file name and dir are used after to save other files
     size_t pos = basefile.find(".xml");
@@ -325,7 +376,48 @@ void MainWindow::on_button_load_segmentation_clicked() // load segmentation XML
     pos = filesession.find("-segmentation-data.xml"); // ends with "-segmentation-data.xml"
     if (pos != std::string::npos) filesession.erase(pos, filesession.length()); // this is what will be used to name files hereafter
 
-    depthmap = cv::imread(filesession + "-segmentation-mask.png", IMREAD_COLOR); // load segmentation mask
+    Size maskSize, imageSize; // sizes from the PNG headers : a mismatch is found before decoding anything
+    if ((ReadPNGSize(filesession + "-segmentation-mask.png", maskSize)) && (ReadPNGSize(filesession + "-segmentation-image.png", imageSize))
+            && (maskSize != imageSize)) { // image and mask sizes not the same -> not good !
+        QMessageBox::critical(this, "Image size error",
+                                    "The image and mask image size (width and height) differ");
+        DisableGUI();
+        return;
+    }
+
+    // all files decoded at the same time by worker threads
+    QFuture<Mat> maskFuture = QtConcurrent::run([filesession]() {
+        return cv::imread(filesession + "-segmentation-mask.png", IMREAD_COLOR); // load segmentation mask
+    });
+    QFuture<Mat> imageFuture = QtConcurrent::run([filesession]() {
+        return cv::imread(filesession + "-segmentation-image.png"); // load reference image
+    });
+    QFuture<sessionData> dataFuture = QtConcurrent::run([filesession]() -> sessionData {
+        sessionData data;
+        data.fs = std::make_shared<cv::FileStorage>(filesession + "-segmentation-data.xml", FileStorage::READ); // open labels file
+        if (!data.fs->isOpened()) { // file not found ?
+            data.errorTitle = "File error";
+            data.error = "There was a problem reading the segmentation data file:\nit must end with ''-segmentation-data.xml''";
+            return data;
+        }
+        try { // try to load labels data
+            Mat labels_temp;
+            (*data.fs)["LabelsMask"] >> labels_temp; // load labels mask
+            data.labels = CompactLabels(labels_temp); // 16 bits per pixel if possible
+        }
+        catch( cv::Exception& e ) // problem ?
+        {
+            data.errorTitle = "XML Segmentation file error";
+            data.error = "There was a problem reading the segmentation XML file\nThe \"LabelsMask\" data is wrong\nError:\n"
+                         + QString(e.what());
+        }
+        return data;
+    });
+    WaitForSessionFiles(QList<QFuture<void>>() << maskFuture << imageFuture << dataFuture, "Loading segmentation session...");
+
+    QApplication::setOverrideCursor(Qt::WaitCursor); // wait cursor for the rest of the loading
+
+    depthmap = maskFuture.result();
     if (depthmap.empty()) { // mask empty, not good !
         QMessageBox::critical(this, "File error",
                               "There was a problem reading the segmentation mask file:\nit must end with ''-segmentation-mask.png''");
@@ -333,7 +425,7 @@ void MainWindow::on_button_load_segmentation_clicked() // load segmentation XML
         return;
     }
 
-    image = cv::imread(filesession + "-segmentation-image.png"); // load reference image
+    image = imageFuture.result();
 
     if (image.empty()) {
         QMessageBox::critical(this, "File error",
@@ -354,28 +446,18 @@ void MainWindow::on_button_load_segmentation_clicked() // load segmentation XML
 
     DeleteAllLabels(); // delete all labels in the list
 
-    cv::FileStorage fs(filesession + "-segmentation-data.xml", FileStorage::READ); // open labels file
-
-    if (!fs.isOpened()) { // file not found ? this error is not handled by the above instructions
-        QMessageBox::critical(this, "File error",
-                              "There was a problem reading the segmentation data file:\nit must end with ''-segmentation-data.xml''");
+    sessionData data = dataFuture.result();
+    if (!data.error.isEmpty()) { // file not found or labels data wrong
+        QMessageBox::critical(this, data.errorTitle, data.error);
         DisableGUI();
         return;
     }
+    cv::FileStorage &fs = *data.fs; // labels fields are read below
 
-    labels.release(); // reset labels data
-    try { // try to load labels data
-        fs["LabelsMask"] >> labels; // load labels mask
-    }
-    catch( cv::Exception& e ) // problem ?
-    {
-        const char* err_msg = e.what();
-        QMessageBox::critical(this, "XML Segmentation file error",
-                              "There was a problem reading the segmentation XML file\nThe \"LabelsMask\" data is wrong\nError:\n"
-                              + QString(err_msg));
-        DisableGUI();
-        return;
-    }
+    ResetLabelShapes(); // before labels change
+    labels = data.labels; // labels mask
+    labelsRuns = IndexLabelRuns(labels); // runs of pixels of all labels
+    StartLabelShapes(); // masks and contours computed in the background
 
     nbLabels = 0; // time to read each label specific data - initialize labels count
     fs["LabelsCount"] >> nbLabels; // read how many labels to load
@@ -387,50 +469,53 @@ void MainWindow::on_button_load_segmentation_clicked() // load segmentation XML
         return;
     }
 
-    ui->listWidget_labels->blockSignals(true); // the labels list must not trigger any action
+    labelStatsIndex stats = ComputeLabelStats(labels, image); // barycenters of all labels, in one pass
+
+    BlockLabelsSignals(true); // the labels list must not trigger any action
+    labelsList.BeginLoad(nbLabels); // the list view is updated only once, at the end
 
     for (int i = 0; i < nbLabels; i++) { // for each label to load
         int num = -1;
         std::string name = "###Error###"; // errors are not handled here, better set rubbish values, the user will see it anyway
-
-        QListWidgetItem *item = new QListWidgetItem (); // create new label item
+        grayGradient gradient; // gradient of this label
         std::string field;
 
         field = "LabelId" + std::to_string(i); // read label id
         fs [field] >> num;
-        item->setData(Qt::UserRole, num); // set it to current label
 
         field = "LabelName" + std::to_string(i); // read label name
         fs [field] >> name;
-        item->setText(QString::fromStdString(name)); // set name to current label
-
-        item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled); // item enabled, editable and selectable
 
-        ui->listWidget_labels->addItem(item); // add the label item to the list
-        item->setSelected(false); // but don't select it !
-
-        Mat1b mask_temp = labels == num; // extract label to temp depthmap
-        Moments m = moments(mask_temp, false); // compute the barycenter of the label representation
-        cv::Point p(m.m10/m.m00, m.m01/m.m00);
+        cv::Point p(image.cols / 2, image.rows / 2); // label not in image : center of image
+        labelStatsIndex::const_iterator found = stats.find(num); // the barycenter of the label representation
+        if (found != stats.end())
+            p = cv::Point(found->second.centroid.x, found->second.centroid.y); // truncated, like before
 
         uchar col = int(round(double(p.y) / image.rows * 255)); // set an arbitray gray level based on the barycenter height in image
 
-        depthmap.setTo(col, mask_temp); // color this label mask in global depthmap with barycenter color
-
-        // set values in the gradients array corresponding to to label id
-        gradients[i].beginColor = col; // gradient begin and end color are barycenter color
-        gradients[i].endColor = col;
-        gradients[i].beginPoint = p; // begin point of gradient arrow is the barycenter
+        // set gradient values of this label
+        gradient.beginColor = col; // gradient begin and end color are barycenter color
+        gradient.endColor = col;
+        gradient.beginPoint = p; // begin point of gradient arrow is the barycenter
         if (p.y - 50 > 0) // the arrow is 50 pixels long (vertical), the head should stay in the image rectangle
-            gradients[i].endPoint = cv::Point(p.x, p.y - 50);
+            gradient.endPoint = cv::Point(p.x, p.y - 50);
         else
-            gradients[i].endPoint = cv::Point(p.x, p.y + 50);
-        gradients[i].gradient = gradient_flat; // gradient flat at first
-        gradients[i].curve = curve_linear; // and gradient curve set to linear
+            gradient.endPoint = cv::Point(p.x, p.y + 50);
+        gradient.gradient = gradient_flat; // gradient flat at first
+        gradient.curve = curve_linear; // and gradient curve set to linear
+
+        labelsList.Append(num, QString::fromStdString(name), gradient); // add the label to the list
     }
 
+    labelsList.EndLoad(); // show labels and index label ids
+
     fs.release(); // close file
 
+    OpenJournal(filesession + "-segmentation-journal.bin"); // gradients edited but not saved yet
+    imageFile = filesession + "-segmentation-image.png"; // image is already in this file
+
+    RebuildAllLabels(); // color all labels in global depthmap with their barycenter color
+
     loaded = true; // we've done it !
 
     ui->label_thumbnail->setPixmap(QPixmap()); // flush current thumbnail
@@ -469,14 +554,24 @@ void MainWindow::on_button_load_segmentation_clicked() // load segmentation XML
     ui->openGLWidget_3d->computeIndexes3D = true; // update openGL widget indexes
     computeColors3D = true; // update openGL widget colors
 
-    ui->listWidget_labels->blockSignals(false); // return to normal for labels
-    ui->listWidget_labels->setCurrentRow(0); // and select the first item
+    BlockLabelsSignals(false); // return to normal for labels
+    SetCurrentLabelRow(0); // and select the first item
 
     QApplication::restoreOverrideCursor(); // Restore cursor
 
     //QMessageBox::information(this, "Load segmentation session", "Session loaded with base name:\n" + QString::fromStdString(filesession));
 }
 
+// codecs of the depthmap mask file : the depthmap is always written on 1 channel
+static const char* saveFormatFilters[] = {"Depthmap session - fast PNG (*.xml)", // PNG level 1 : fast, bigger files
+                                          "Depthmap session - PNG (*.xml)", // PNG level 3 : OpenCV default
+                                          "Depthmap session - small PNG (*.xml)", // PNG level 9 : slow, smallest files
+                                          "Depthmap session - uncompressed TIFF (*.xml)", // no compression at all
+                                          "Depthmap session - PFM (*.xml)"}; // 32-bit float gray levels, 0 to 1
+static const char* saveFormatExtensions[] = {".png", ".png", ".png", ".tif", ".pfm"}; // depthmap mask file extension
+static const int saveFormatPNGLevels[] = {1, 3, 9, 1, 1}; // PNG compression of the mask and the reference image - speed first for TIFF and PFM
+static const char* maskExtensions[] = {".png", ".tif", ".pfm"}; // all possible mask files, the loader takes the first one found
+
 void MainWindow::on_button_save_depthmap_clicked() // save XML and image depthmap files
 {
     if (!loaded) { // nothing loaded yet = get out
@@ -485,13 +580,26 @@ void MainWindow::on_button_save_depthmap_clicked() // save XML and image depthma
         return;
     }
 
-    QString filename = QFileDialog::getSaveFileName(this, "Save depthmap to XML file...", "./" + QString::fromStdString(basedir + basefile + "-depthmap-data.xml"), "*.xml *.XML"); // filename
+    if (saveWatcher.isRunning()) { // only one save at a time
+        QMessageBox::warning(this, "Save depthmap session",
+                                 "Not now!\n\nThe previous save is not finished yet");
+        return;
+    }
+
+    QString filters; // one filter per codec of the depthmap mask
+    for (int format = 0; format < save_formats_count; format++)
+        filters += QString(format > 0 ? ";;" : "") + saveFormatFilters[format];
+    QString filter = saveFormatFilters[saveFormatUsed]; // last codec used
+    QString filename = QFileDialog::getSaveFileName(this, "Save depthmap to XML file...", "./" + QString::fromStdString(basedir + basefile + "-depthmap-data.xml"), filters, &filter); // filename
 
     if (filename.isNull() || filename.isEmpty()) // cancel ?
         return;
 
-    QApplication::setOverrideCursor(Qt::WaitCursor); // wait cursor
-    qApp->processEvents();
+    for (int format = 0; format < save_formats_count; format++) // codec chosen
+        if (filter == saveFormatFilters[format])
+            saveFormatUsed = saveFormat(format);
+
+    FinishDepthmapJobs(); // save all edits
 
     /*// base file name and dir can change so reset them
     basefile = filename.toUtf8().constData(); // base file name and dir are used after to save other files
@@ -511,74 +619,241 @@ void MainWindow::on_button_save_depthmap_clicked() // save XML and image depthma
     pos = filesession.find(".xml"); // use base file name
     if (pos != std::string::npos) filesession.erase(pos, filesession.length());
 
-    bool write;
-    Mat depthmap_temp;
-    cvtColor(depthmap, depthmap_temp, COLOR_GRAY2RGB);
-    write = cv::imwrite(filesession + "-depthmap-mask.png", depthmap_temp); // save depthmap mask
-    if (!write) { // problem ?
-        QApplication::restoreOverrideCursor(); // Restore cursor
-        QMessageBox::critical(this, "File error",
-                              "There was a problem saving the depthmap mask image file");
+    // snapshot of the session : Mats only share their data, the depthmap worker never writes in a buffer still used by the save
+    sessionSnapshot snapshot;
+    snapshot.filesession = filesession;
+    snapshot.format = saveFormatUsed;
+    snapshot.depthmap = depthmap;
+    saveDepthmapData = depthmap.data; // the worker must not write in this buffer until the save is done
+    snapshot.image = image;
+    snapshot.imageFile = imageFile;
+    snapshot.labels = labels;
+    snapshot.ids = labelsList.Ids();
+    snapshot.gradients = labelsList.Gradients();
+    snapshot.names.reserve(labelsList.Count());
+    for (int i = 0; i < labelsList.Count(); i++)
+        snapshot.names.push_back(labelsList.Name(i).toUtf8().constData());
+
+    saveBaseName = QString::fromStdString(basefile);
+    saveFileName = QString::fromStdString(filesession + "-depthmap-data.xml");
+    saveJournalFile = filesession + "-depthmap-journal.bin"; // edits made from now on go to the journal of the saved session
+    saveJournalIds.swap(journalIds); // edits in the snapshot
+    saveImageFile = filesession + "-depthmap-image.png";
+
+    saveProgress->setValue(0);
+    QProgressDialog *progress = saveProgress;
+    saveWatcher.setFuture(QtConcurrent::run([snapshot, progress]() {
+        return SaveSessionFiles(snapshot, progress);
+    })); // editing can go on, SaveSessionFinished is called when all files are written
+}
+
+void MainWindow::SaveSessionFinished() // all files of the session are written, or something went wrong
+{
+    saveProgress->reset(); // hide progress dialog
+    saveResult result = saveWatcher.result();
+    saveDepthmapData = NULL; // the depthmap buffer of the snapshot can be written again
+
+    if (!result.error.isEmpty()) { // problem ?
+        journalIds.insert(saveJournalIds.begin(), saveJournalIds.end()); // edits of the snapshot are not saved : keep them in the journal
+        saveJournalIds.clear();
+        QMessageBox::critical(this, "File error", result.error);
         return;
     }
 
-    write = cv::imwrite(filesession + "-depthmap-image.png", image); // save reference image
-    if (!write) { // problem ?
-        QApplication::restoreOverrideCursor(); // Restore cursor
-        QMessageBox::critical(this, "File error",
-                              "There was a problem saving the depthmap image file");
-        return;
+    if (!saveJournalFile.empty()) { // still the same session
+        saveJournalIds.clear(); // these edits are in the saved files
+        CompactJournal(saveJournalFile); // only edits made during the save are left, in the journal of the saved session
+        imageFile = saveImageFile; // image is now in this file
     }
 
-    cv::FileStorage fs(filesession + "-depthmap-data.xml", cv::FileStorage::WRITE); // open depthmap XML file for writing
-    if (!fs.isOpened()) { // problem ?
-        QApplication::restoreOverrideCursor(); // Restore cursor
-        QMessageBox::critical(this, "File error",
-                              "There was a problem writing the depthmap data file");
-        return;
+    ui->label_filename->setText(saveFileName); // display new file name in ui
+
+    QMessageBox::information(this, "Save depthmap session", "Session successfuly saved with base name:\n" + saveBaseName
+                             + "\n\nTime: " + QString::number(result.milliseconds / 1000.0, 'f', 2) + " s"
+                             + "\nSize: " + QString::number(result.bytes / 1048576.0, 'f', 2) + " MB");
+}
+
+static bool WriteSessionFile(const std::string &filename, const char* data, const qint64 &size) // replace a file only when the new one is complete
+{
+    QSaveFile file(QString::fromStdString(filename)); // written in a temporary file, renamed by commit
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    if (file.write(data, size) != size) { // disk full ?
+        file.cancelWriting();
+        return false;
     }
 
-    fs << "LabelsCount" << nbLabels; // write labels count
+    return file.commit();
+}
+
+MainWindow::saveResult MainWindow::SaveSessionFiles(const sessionSnapshot &snapshot, QProgressDialog *progress) // encode and write all files of a session, in a worker thread
+{
+    QElapsedTimer timer; // whole save time
+    timer.start();
+    saveResult result;
+    result.bytes = 0;
+
+    std::atomic<int> done(0); // steps done
+    auto step = [&done, progress]() { // update progress dialog in the GUI thread
+        int value = ++done;
+        QMetaObject::invokeMethod(progress, "setValue", Qt::QueuedConnection, Q_ARG(int, value));
+    };
+
+    std::string maskfile = snapshot.filesession + "-depthmap-mask" + saveFormatExtensions[snapshot.format];
+    std::string imagefile = snapshot.filesession + "-depthmap-image.png";
+    std::string labelsfile = snapshot.filesession + "-depthmap-labels.bin"; // labels are in a compressed binary file, the XML only has its name
+    std::string xmlfile = snapshot.filesession + "-depthmap-data.xml";
+    int pngLevel = saveFormatPNGLevels[snapshot.format];
+
+    // the reference image never changes : if it is already in a PNG file it is copied, or even left untouched
+    bool imageKept = false; // the image file is already there
+    QByteArray imageCopy; // contents of the image file to copy
+    if (!snapshot.imageFile.empty()) {
+        QFileInfo source(QString::fromStdString(snapshot.imageFile));
+        if (source == QFileInfo(QString::fromStdString(imagefile))) // same file
+            imageKept = source.exists();
+        else {
+            QFile file(source.filePath());
+            if (file.open(QIODevice::ReadOnly))
+                imageCopy = file.readAll();
+        }
+    }
 
-    for (int i = 0; i < nbLabels; i++) { // for each label
+    // all files are encoded in memory at the same time...
+    QFuture<std::vector<uchar>> mask = QtConcurrent::run([&snapshot, &step, pngLevel]() {
+        std::vector<uchar> data;
+        bool encoded;
+        switch (snapshot.format) {
+            case save_tiff: encoded = cv::imencode(".tif", snapshot.depthmap, data, {IMWRITE_TIFF_COMPRESSION, 1}); break; // 1 = no compression
+            case save_pfm: {
+                Mat depthmap_float;
+                snapshot.depthmap.convertTo(depthmap_float, CV_32F, 1.0 / 255.0); // gray levels from 0 to 1
+                encoded = cv::imencode(".pfm", depthmap_float, data);
+                break;
+            }
+            default: encoded = cv::imencode(".png", snapshot.depthmap, data, {IMWRITE_PNG_COMPRESSION, pngLevel}); // gray PNG
+        }
+        if (!encoded) // depthmap mask
+            data.clear();
+        step();
+        return data;
+    });
+    QFuture<std::vector<uchar>> image = QtConcurrent::run([&snapshot, &step, imageKept, &imageCopy, pngLevel]() {
+        std::vector<uchar> png;
+        if ((!imageKept) && (imageCopy.isEmpty()) && (!cv::imencode(".png", snapshot.image, png, {IMWRITE_PNG_COMPRESSION, pngLevel}))) // reference image
+            png.clear();
+        step();
+        return png;
+    });
+    QFuture<QByteArray> labels = QtConcurrent::run([&snapshot, &step]() {
+        QByteArray data = EncodeLabelsFile(snapshot.labels); // labels
+        step();
+        return data;
+    });
+
+    cv::FileStorage fs(".xml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY); // depthmap XML file, in memory
+    fs << "LabelsCount" << int(snapshot.ids.size()); // write labels count
+
+    for (size_t i = 0; i < snapshot.ids.size(); i++) { // for each label
         std::string field;
 
-        QListWidgetItem *item = ui->listWidget_labels->item(i); // get label id
+        const grayGradient &gradient = snapshot.gradients[i]; // gradient of this label
         field = "LabelId" + std::to_string(i);
-        fs << field << item->data(Qt::UserRole).toInt(); // write label id
+        fs << field << snapshot.ids[i]; // write label id
 
-        std::string name = item->text().toUtf8().constData(); // write label name
         field = "LabelName" + std::to_string(i);
-        fs << field << name;
+        fs << field << snapshot.names[i]; // write label name
 
         field = "GradientType" + std::to_string(i);
-        fs << field << gradients[i].gradient; // write gradient type
+        fs << field << gradient.gradient; // write gradient type
 
         field = "GradientCurve" + std::to_string(i);
-        fs << field << gradients[i].curve; // write gradient curve
+        fs << field << gradient.curve; // write gradient curve
 
         field = "GradientBeginColor" + std::to_string(i);
-        fs << field << gradients[i].beginColor; // write gradient begin color
+        fs << field << gradient.beginColor; // write gradient begin color
 
         field = "GradientEndColor" + std::to_string(i);
-        fs << field << gradients[i].endColor; // write gradient end color
+        fs << field << gradient.endColor; // write gradient end color
 
         field = "GradientBeginPoint" + std::to_string(i);
-        fs << field << gradients[i].beginPoint; // write gradient begin point
+        fs << field << gradient.beginPoint; // write gradient begin point
 
         field = "GradientEndPoint" + std::to_string(i);
-        fs << field << gradients[i].endPoint; // write gradient end point
-    }
-
-    fs << "Labels" << labels; // write labels data
-
-    fs.release(); // close file
-
-    ui->label_filename->setText(QString::fromStdString(filesession + "-depthmap-data.xml")); // display new file name in ui
-
-    QApplication::restoreOverrideCursor(); // Restore cursor
-
-    QMessageBox::information(this, "Save depthmap session", "Session successfuly saved with base name:\n" + QString::fromStdString(basefile));
+        fs << field << gradient.endPoint; // write gradient end point
+    }
+
+    size_t found = labelsfile.find_last_of("/"); // only the file name, the file is next to the XML file
+    fs << "LabelsFile" << labelsfile.substr(found + 1); // write labels file name
+    std::string xml = fs.releaseAndGetString(); // XML text
+    step();
+
+    std::vector<uchar> mask_data = mask.result(); // wait for the encoders
+    std::vector<uchar> image_png = image.result();
+    QByteArray labels_data = labels.result();
+
+    result.error = "There was a problem saving the depthmap mask image file";
+    if (mask_data.empty())
+        return result;
+    result.error = "There was a problem saving the depthmap image file";
+    if ((!imageKept) && (imageCopy.isEmpty()) && (image_png.empty()))
+        return result;
+
+    // ... then written, each file replaced only when complete, the XML file last so an interrupted save never points to missing data
+    result.error = "There was a problem saving the depthmap mask image file";
+    if (!WriteSessionFile(maskfile, reinterpret_cast<const char*>(mask_data.data()), qint64(mask_data.size())))
+        return result;
+    step();
+    result.error = "There was a problem saving the depthmap image file";
+    if ((!imageKept) && (!imageCopy.isEmpty()) && (!WriteSessionFile(imagefile, imageCopy.constData(), qint64(imageCopy.size()))))
+        return result;
+    if ((!imageKept) && (imageCopy.isEmpty()) && (!WriteSessionFile(imagefile, reinterpret_cast<const char*>(image_png.data()), qint64(image_png.size()))))
+        return result;
+    step();
+    result.error = "There was a problem saving the depthmap labels file";
+    if (!WriteSessionFile(labelsfile, labels_data.constData(), qint64(labels_data.size())))
+        return result;
+    step();
+    result.error = "There was a problem writing the depthmap data file";
+    if (!WriteSessionFile(xmlfile, xml.data(), qint64(xml.size())))
+        return result;
+    step();
+    result.error.clear(); // no error
+
+    for (const char* extension : maskExtensions) // masks of older saves in other formats would be loaded instead of this one
+        if (snapshot.filesession + "-depthmap-mask" + extension != maskfile)
+            QFile::remove(QString::fromStdString(snapshot.filesession + "-depthmap-mask" + extension));
+
+    result.bytes = QFileInfo(QString::fromStdString(maskfile)).size() + QFileInfo(QString::fromStdString(imagefile)).size()
+                 + QFileInfo(QString::fromStdString(labelsfile)).size() + qint64(xml.size()); // session size on disk
+    result.milliseconds = timer.elapsed();
+
+    return result;
+}
+
+void MainWindow::WaitForSessionFiles(const QList<QFuture<void>> &files, const QString &title) // wait for files decoded by worker threads, showing progress
+{
+    QProgressDialog progress(title, QString(), 0, files.size(), this); // no cancel button
+    progress.setWindowModality(Qt::WindowModal); // no edits while the session is replaced, but the window is still drawn
+    progress.setMinimumDuration(500); // only shown for long loads
+    progress.setValue(0);
+
+    QEventLoop loop; // runs until all files are decoded
+    int done = 0; // files decoded
+    std::vector<std::unique_ptr<QFutureWatcher<void>>> watchers;
+    for (int n = 0; n < files.size(); n++) {
+        watchers.emplace_back(new QFutureWatcher<void>);
+        connect(watchers.back().get(), &QFutureWatcher<void>::finished, [&]() {
+            done++;
+            progress.setValue(done);
+            if (done == files.size())
+                loop.quit();
+        });
+        watchers.back()->setFuture(files[n]); // finished is also sent if this file is already decoded
+    }
+
+    if (done < files.size())
+        loop.exec(QEventLoop::ExcludeUserInputEvents); // the window is still drawn, clicks wait for the end of the loading
 }
 
 void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
@@ -588,8 +863,7 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
     if (filename.isNull() || filename.isEmpty()) // cancel ?
         return;
 
-    QApplication::setOverrideCursor(Qt::WaitCursor); // wait cursor
-    qApp->processEvents();
+    ResetDepthmapJobs(); // depthmap is going to be replaced
 
     /*basefile = filename.toUtf8().constData(); // base file name and dir are used after to save other files
     size_t pos = basefile.find(".xml");
@@ -615,17 +889,78 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
     pos = filesession.find("-depthmap-data.xml"); // ends with "depthmap-data.xml"
     if (pos != std::string::npos) filesession.erase(pos, filesession.length());
 
-    depthmap = cv::imread(filesession + "-depthmap-mask.png", IMREAD_COLOR); // load depthmap mask
-    if (depthmap.channels() > 1)
-        cvtColor(depthmap, depthmap, COLOR_BGR2GRAY);
-    if (depthmap.empty()) { // problem ?
-        QMessageBox::critical(this, "File error",
-                              "There was a problem reading the depthmap mask file:\nit must end with ''-depthmap-mask.png''");
+    std::string maskfile = filesession + "-depthmap-mask.png"; // the mask can be saved with several codecs
+    for (const char* extension : maskExtensions)
+        if (QFile::exists(QString::fromStdString(filesession + "-depthmap-mask" + extension))) {
+            maskfile = filesession + "-depthmap-mask" + extension;
+            break;
+        }
+
+    Size maskSize, imageSize; // sizes from the PNG headers : a mismatch is found before decoding anything
+    if ((ReadPNGSize(maskfile, maskSize)) && (ReadPNGSize(filesession + "-depthmap-image.png", imageSize))
+            && (maskSize != imageSize)) { // image and mask sizes not the same -> not good !
+        QMessageBox::critical(this, "Image size error",
+                                    "The image and mask image size (width and height) differ");
         DisableGUI();
         return;
     }
 
-    image = cv::imread(filesession + "-depthmap-image.png"); // load reference image
+    // all files decoded at the same time by worker threads
+    QFuture<Mat> maskFuture = QtConcurrent::run([maskfile]() {
+        Mat mask = cv::imread(maskfile, IMREAD_UNCHANGED); // load depthmap mask - if missing it will be rebuilt from the gradients
+        if (mask.depth() == CV_32F) // PFM : gray levels from 0 to 1
+            mask.convertTo(mask, CV_8U, 255.0);
+        if (mask.channels() == 3) // older sessions : RGB mask
+            cvtColor(mask, mask, COLOR_BGR2GRAY);
+        else if (mask.channels() == 4)
+            cvtColor(mask, mask, COLOR_BGRA2GRAY);
+        return mask;
+    });
+    QFuture<Mat> imageFuture = QtConcurrent::run([filesession]() {
+        return cv::imread(filesession + "-depthmap-image.png"); // load reference image
+    });
+    QFuture<sessionData> dataFuture = QtConcurrent::run([filesession]() -> sessionData {
+        sessionData data;
+        data.fs = std::make_shared<cv::FileStorage>(filesession + "-depthmap-data.xml", FileStorage::READ); // open labels file
+        if (!data.fs->isOpened()) { // file not opened
+            data.errorTitle = "File error";
+            data.error = "There was a problem reading the depthmap data file:\nit must end with ''-depthmap-data.xml''";
+            return data;
+        }
+
+        Mat labels_temp; // labels on 1 channel
+        (*data.fs)["LabelsFile"] >> data.labelsFile; // labels in a binary file ? (newer sessions)
+        if (!data.labelsFile.empty()) {
+            size_t found = filesession.find_last_of("/"); // the file is next to the XML file
+            labels_temp = LoadLabelsFile(filesession.substr(0, found + 1) + data.labelsFile); // load labels
+            if (labels_temp.empty()) { // missing or corrupted
+                data.errorTitle = "Depthmap labels file error";
+                data.error = "There was a problem reading the depthmap labels file:\n" + QString::fromStdString(data.labelsFile);
+                return data;
+            }
+        }
+        else { // older sessions : labels in the XML file
+            try { // try to read labels data
+                (*data.fs)["Labels"] >> labels_temp; // load labels
+            }
+            catch( cv::Exception& e ) // problem ?
+            {
+                data.errorTitle = "XML Depthmap file error";
+                data.error = "There was a problem reading the depthmap XML file\nThe \"Labels\" data is wrong\nError:\n"
+                             + QString(e.what());
+                return data;
+            }
+        }
+        data.labels = CompactLabels(labels_temp); // 16 bits per pixel if possible
+
+        return data;
+    });
+    WaitForSessionFiles(QList<QFuture<void>>() << maskFuture << imageFuture << dataFuture, "Loading depthmap session...");
+
+    QApplication::setOverrideCursor(Qt::WaitCursor); // wait cursor for the rest of the loading
+
+    depthmap = maskFuture.result();
+    image = imageFuture.result();
 
     if (image.empty()) {
         QMessageBox::critical(this, "File error",
@@ -634,7 +969,7 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
         return;
     }
 
-    if ((image.cols != depthmap.cols) | (image.rows != depthmap.rows)) { // image and mask sizes not the same -> not good !
+    if ((!depthmap.empty()) & ((image.cols != depthmap.cols) | (image.rows != depthmap.rows))) { // image and mask sizes not the same -> not good !
         QMessageBox::critical(this, "Image size error",
                                     "The image and mask image size (width and height) differ");
         DisableGUI();
@@ -645,30 +980,22 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
 
     DeleteAllLabels(); // delete all labels in the list
 
-    cv::FileStorage fs(filesession + "-depthmap-data.xml", FileStorage::READ); // open labels file
-
-    if (!fs.isOpened()) { // file not opened, not handled by above instructions
-        QMessageBox::critical(this, "File error",
-                              "There was a problem reading the depthmap data file:\nit must end with ''-depthmap-data.xml''");
-        DisableGUI();
-        return;
-    }
-
-    Mat labels_temp = Mat::zeros(image.rows, image.cols, CV_32SC1); // labels on 1 channel
-    try { // try to read labels data
-        fs["Labels"] >> labels_temp; // load labels
+    sessionData data = dataFuture.result();
+    if ((data.error.isEmpty()) && (!data.labelsFile.empty()) && (data.labels.size() != image.size())) { // labels file of another image ?
+        data.errorTitle = "Depthmap labels file error";
+        data.error = "There was a problem reading the depthmap labels file:\n" + QString::fromStdString(data.labelsFile);
     }
-    catch( cv::Exception& e ) // problem ?
-    {
-        const char* err_msg = e.what(); // get error from openCV
-        QMessageBox::critical(this, "XML Depthmap file error",
-                              "There was a problem reading the depthmap XML file\nThe \"Labels\" data is wrong\nError:\n"
-                              + QString(err_msg));
+    if (!data.error.isEmpty()) { // file not opened or labels data wrong
+        QMessageBox::critical(this, data.errorTitle, data.error);
         DisableGUI();
         return;
     }
+    cv::FileStorage &fs = *data.fs; // labels fields are read below
 
-    labels_temp.copyTo(labels); // valid data copied to labels
+    ResetLabelShapes(); // before labels change
+    labels = data.labels; // valid data copied to labels
+    labelsRuns = IndexLabelRuns(labels); // runs of pixels of all labels
+    StartLabelShapes(); // masks and contours computed in the background
 
     nbLabels = 0; // labels count
     fs["LabelsCount"] >> nbLabels; // read how many labels to load ?
@@ -680,7 +1007,8 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
         return;
     }
 
-    ui->listWidget_labels->blockSignals(true); // don't trigger events when populating labels list
+    BlockLabelsSignals(true); // don't trigger events when populating labels list
+    labelsList.BeginLoad(nbLabels); // the list view is updated only once, at the end
 
     for (int i = 0; i < nbLabels; i++) { // for each label to load
         std::string name ="###Error###"; // init default values, no error handling this time, the user should see if there was a problem
@@ -689,50 +1017,56 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
         int color = 255;
         int gtype = 0;
         int gcurve = 0;
-
-        QListWidgetItem *item = new QListWidgetItem (); // create new label item
+        grayGradient gradient; // gradient of this label
         std::string field;
 
         field = "LabelId" + std::to_string(i); // read label id
         fs [field] >> num;
-        item->setData(Qt::UserRole, num); // set it to current label
 
         field = "LabelName" + std::to_string(i); // read label name
         fs [field] >> name;
-        item->setText(QString::fromStdString(name)); // set name to current label
-
-        item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled); // item enabled and selectable
-
-        ui->listWidget_labels->addItem(item); // add new item to labels list
-        item->setSelected(false); // don't select it !
 
         field = "GradientType" + std::to_string(i);
         fs [field] >> gtype; // load gradient type
-        gradients[i].gradient = gradientType(gtype);
+        gradient.gradient = gradientType(gtype);
 
         field = "GradientCurve" + std::to_string(i);
         fs [field] >> gcurve; // load curve type
-        gradients[i].curve = curveType(gcurve);
+        gradient.curve = curveType(gcurve);
 
         field = "GradientBeginColor" + std::to_string(i);
         fs [field] >> color; // load gradient begin color
-        gradients[i].beginColor = color;
+        gradient.beginColor = color;
 
         field = "GradientEndColor" + std::to_string(i);
         fs [field] >> color; // load gradient end color
-        gradients[i].endColor = color;
+        gradient.endColor = color;
 
         field = "GradientBeginPoint" + std::to_string(i);
         fs [field] >> point; // load gradient begin point
-        gradients[i].beginPoint = point;
+        gradient.beginPoint = point;
 
         field = "GradientEndPoint" + std::to_string(i);
         fs [field] >> point; // load gradient end point
-        gradients[i].endPoint = point;
+        gradient.endPoint = point;
+
+        labelsList.Append(num, QString::fromStdString(name), gradient); // add the label to the list
     }
 
+    labelsList.EndLoad(); // show labels and index label ids
+
     fs.release(); // close file
 
+    bool edited = OpenJournal(filesession + "-depthmap-journal.bin"); // gradients edited after the last save
+    imageFile = filesession + "-depthmap-image.png"; // image is already in this file
+
+    if (depthmap.empty()) { // no depthmap mask file : rebuild it from the gradients
+        depthmap = Mat::zeros(image.rows, image.cols, CV_8UC1);
+        RebuildAllLabels();
+    }
+    else if (edited) // the depthmap mask file doesn't have the edits of the journal
+        RebuildAllLabels();
+
     loaded = true; // all good !
 
     ui->label_filename->setText(filename); // display file name in ui
@@ -774,8 +1108,8 @@ void MainWindow::on_button_load_depthmap_clicked() // load depthmap XML file
     ui->openGLWidget_3d->computeIndexes3D = true; // update openGL widget indexes
     computeColors3D = true; // update openGL widget colors
 
-    ui->listWidget_labels->blockSignals(false); // return to normal for labels
-    ui->listWidget_labels->setCurrentRow(0); // select first row of the list
+    BlockLabelsSignals(false); // return to normal for labels
+    SetCurrentLabelRow(0); // select first row of the list
 
     QApplication::restoreOverrideCursor(); // Restore cursor
 
@@ -817,6 +1151,9 @@ void MainWindow::on_button_load_rgbd_clicked() // load previous session
     ChangeBaseDir(filename);
     filesession = filename.toUtf8().constData(); // base file name
 
+    ResetDepthmapJobs(); // depthmap is going to be replaced
+    CloseJournal(); // no session file yet, edits are journaled after the first save
+    imageFile.clear(); // any format : image will be encoded when saved
     depthmap = cv::imread(filesession, IMREAD_COLOR); // load depthmap
     if (depthmap.channels() > 1)
         cvtColor(depthmap, depthmap, COLOR_BGR2GRAY);
@@ -833,6 +1170,8 @@ void MainWindow::on_button_load_rgbd_clicked() // load previous session
     selection = Mat::zeros(image.rows, image.cols, CV_8UC3); // initialize selection mask to image size
 
     labels = Mat::zeros(image.rows, image.cols, CV_32SC1); // labels on 1 channel
+    ResetLabelShapes(); // before labels change
+    labelsRuns.clear(); // no labels
 
     DeleteAllLabels(); // delete all labels but do not create a new one
 
@@ -877,7 +1216,6 @@ void MainWindow::on_button_load_rgbd_clicked() // load previous session
     ui->openGLWidget_3d->depthmap3D = depthmap; // init 3D scene
     ui->openGLWidget_3d->image3D = image;
     ui->openGLWidget_3d->area3D = Rect(0, 0, image.rows, image.cols);
-    ui->openGLWidget_3d->mask3D = Mat(image.rows, image.cols, CV_8UC1);
     ui->openGLWidget_3d->computeVertices3D = true; // recompute the 3d scene
     ui->openGLWidget_3d->computeIndexes3D = true; // update openGL widget indexes
     ui->openGLWidget_3d->computeColors3D = true;
@@ -896,7 +1234,9 @@ void MainWindow::on_button_save_ply_clicked() // save XML and image depthmap fil
         return;
     }
 
-    QString filename = QFileDialog::getSaveFileName(this, "Save mesh to PLY file...", "./" + QString::fromStdString(basedir + basefile + ".ply"), "*.ply *.PLY"); // filename
+    QString filter = "Binary PLY (*.ply *.PLY)"; // binary is the default : much smaller and faster
+    QString filename = QFileDialog::getSaveFileName(this, "Save mesh to PLY file...", "./" + QString::fromStdString(basedir + basefile + ".ply"),
+                                                    "Binary PLY (*.ply *.PLY);;ASCII PLY (*.ply *.PLY)", &filter); // filename
 
     if (filename.isNull() || filename.isEmpty()) // cancel ?
         return;
@@ -904,10 +1244,18 @@ void MainWindow::on_button_save_ply_clicked() // save XML and image depthmap fil
     QApplication::setOverrideCursor(Qt::WaitCursor); // wait cursor
     qApp->processEvents();
 
-    ui->openGLWidget_3d->SaveToPly(filename);
+    FinishDepthmapJobs(); // the mesh is computed from the depthmap given to the 3D view : all edits must be in it
+    FinishBlurJob(); // and the blur too
+    bool write = ui->openGLWidget_3d->SaveToPly(filename, !filter.startsWith("ASCII"));
 
     QApplication::restoreOverrideCursor(); // Restore cursor
 
+    if (!write) { // problem ?
+        QMessageBox::critical(this, "File error",
+                              "There was a problem writing the PLY file");
+        return;
+    }
+
     QMessageBox::information(this, "Export 3D mesh", "Mesh successfully exported with file name:\n" + filename);
 }
 
@@ -1033,11 +1381,11 @@ void MainWindow::ShowGradient() // show gradient example from current label
     Mat1b msk = cv::Mat::zeros(ui->label_gradient->height(), ui->label_gradient->width(), CV_8UC1); // the gradient needs a mask
     msk = 255; // fill the mask with non-zero values
 
-    int row = ui->listWidget_labels->currentRow(); // get current label
+    grayGradient current = labelsList.Gradient(CurrentLabelRow()); // gradient of current label
 
     cv::Point beginPoint, endPoint; // begin and end points will change with gradient example type
 
-    switch (gradients[row].gradient) {
+    switch (current.gradient) {
         case gradient_flat: {
             break;
         }
@@ -1057,9 +1405,9 @@ void MainWindow::ShowGradient() // show gradient example from current label
             break;
         }
     }
-    GradientFillGray(gradients[row].gradient, gradient, msk,
+    GradientFillGray(current.gradient, gradient, msk,
                      beginPoint, endPoint,
-                     gradients[row].beginColor, gradients[row].endColor,
+                     current.beginColor, current.endColor,
                      ui->listWidget_gradient_curve->currentRow()); // fill shape with gray gradient
 
     cvtColor(gradient, gradient, COLOR_GRAY2BGR);
@@ -1125,7 +1473,7 @@ void MainWindow::on_radioButton_flat_clicked() // flat gradient selected
 
     if (ui->radioButton_flat->isChecked()) {
         BlockGradientsSignals(true);
-        gradients[ui->listWidget_labels->currentRow()].gradient = gradient_flat; // change value in gradients array
+        labelsList.SetGradientType(CurrentLabelRow(), gradient_flat); // change value in gradients array
         BlockGradientsSignals(false);
         ShowGradient(); // show gradient example
         ChangeLabelGradient(); // apply effect
@@ -1139,7 +1487,7 @@ void MainWindow::on_radioButton_linear_clicked() // linear gradient selected
 
     if (ui->radioButton_linear->isChecked()) {
         BlockGradientsSignals(true);
-        gradients[ui->listWidget_labels->currentRow()].gradient = gradient_linear;
+        labelsList.SetGradientType(CurrentLabelRow(), gradient_linear);
         BlockGradientsSignals(false);
         ShowGradient();
         ChangeLabelGradient();
@@ -1153,7 +1501,7 @@ void MainWindow::on_radioButton_double_linear_clicked() // bi-linear gradient se
 
     if (ui->radioButton_double_linear->isChecked()) {
         BlockGradientsSignals(true);
-        gradients[ui->listWidget_labels->currentRow()].gradient = gradient_doubleLinear;
+        labelsList.SetGradientType(CurrentLabelRow(), gradient_doubleLinear);
         BlockGradientsSignals(false);
         ShowGradient();
         ChangeLabelGradient();
@@ -1167,7 +1515,7 @@ void MainWindow::on_radioButton_radial_clicked() // radial gradient selected
 
     if (ui->radioButton_radial->isChecked()) {
         BlockGradientsSignals(true);
-        gradients[ui->listWidget_labels->currentRow()].gradient = gradient_radial;
+        labelsList.SetGradientType(CurrentLabelRow(), gradient_radial);
         BlockGradientsSignals(false);
         ShowGradient();
         ChangeLabelGradient();
@@ -1180,7 +1528,7 @@ void MainWindow::on_horizontalSlider_begin_valueChanged(int value) // begin colo
         return;
 
     BlockGradientsSignals(true);
-    gradients[ui->listWidget_labels->currentRow()].beginColor = value; // change value in gradients array
+    labelsList.SetBeginColor(CurrentLabelRow(), value); // change value in gradients array
     BlockGradientsSignals(false);
 
     ShowGradient(); // show gradient example
@@ -1194,7 +1542,7 @@ void MainWindow::on_horizontalSlider_end_valueChanged(int value) // end color fo
         return;
 
     BlockGradientsSignals(true);
-    gradients[ui->listWidget_labels->currentRow()].endColor = value;
+    labelsList.SetEndColor(CurrentLabelRow(), value);
     BlockGradientsSignals(false);
 
     ShowGradient();
@@ -1208,7 +1556,7 @@ void MainWindow::on_listWidget_gradient_curve_currentItemChanged(QListWidgetItem
         return;
 
     BlockGradientsSignals(true);
-    gradients[ui->listWidget_labels->currentRow()].curve = curveType(ui->listWidget_gradient_curve->currentRow()); // change value in gradients array
+    labelsList.SetCurve(CurrentLabelRow(), curveType(ui->listWidget_gradient_curve->currentRow())); // change value in gradients array
     BlockGradientsSignals(false);
 
     ShowGradient(); // show gradient example
@@ -1246,6 +1594,21 @@ void MainWindow::on_horizontalSlider_depth3D_valueChanged(int value) // change d
     ui->openGLWidget_3d->update(); // view 3D scene
 }
 
+void MainWindow::on_doubleSpinBox_3d_mesh_error_valueChanged(double value) // change depth error allowed by the adaptive 3D mesh
+{
+    ui->openGLWidget_3d->meshError3D = value; // 0 = full resolution
+    ui->openGLWidget_3d->computeIndexes3D = true; // new mesh
+    ui->openGLWidget_3d->update(); // view 3D scene
+}
+
+void MainWindow::ShowMesh3D(int triangles, double error) // triangles and depth error of the 3D mesh
+{
+    if (ui->doubleSpinBox_3d_mesh_error->value() > 0) // adaptive mesh
+        ui->label_3d_mesh->setText(QString::number(triangles) + " triangles - error " + QString::number(error, 'f', 2));
+    else
+        ui->label_3d_mesh->setText(QString::number(triangles) + " triangles");
+}
+
 void MainWindow::on_checkBox_3d_anaglyph_clicked() // activate or not anaglyph view
 {
     ui->openGLWidget_3d->anaglyphEnabled = ui->checkBox_3d_anaglyph->isChecked(); // set value
@@ -1275,14 +1638,13 @@ void MainWindow::on_checkBox_3d_axes_clicked() // show or not the 3D axes
 void MainWindow::on_checkBox_3d_blur_clicked() // blur depthmap for 3D view
 {
     if (ui->checkBox_3d_blur->isChecked()) { // blur activated
-        Mat depthmap3D_temp;
-        cv::GaussianBlur(depthmap, depthmap3D_temp,
-                         Size(ui->horizontalSlider_blur_amount->value() * 2 + 1,
-                              ui->horizontalSlider_blur_amount->value() * 2 + 1), 0, 0); // gaussian blur image
-        ui->openGLWidget_3d->depthmap3D = depthmap3D_temp; // copy blurred depthmap
+        blurPending = true; // computed in the background
+        StartBlurJob();
+        return;
     }
-    else // no blur
-        ui->openGLWidget_3d->depthmap3D = depthmap; // copy original depthmap
+
+    ui->openGLWidget_3d->depthmap3D = depthmap; // no blur : copy original depthmap
+    blurVersion3D = -1;
 
     ui->openGLWidget_3d->updateVertices3D = true; // recompute 3D scene
     ui->openGLWidget_3d->updateAllVertices3D = true; // for all image
@@ -1655,6 +2017,8 @@ void MainWindow::mouseReleaseEvent(QMouseEvent *eventRelease) // event triggered
 {
     QApplication::restoreOverrideCursor(); // Restore cursor
 
+    FlushLabelGradient(); // last position of the handle, if not already computed
+
     if (moveBegin) { // move origin of label vector
         moveBegin = false; // stop moving
         updateVertices3D = true; // recompute 3D
@@ -1691,32 +2055,29 @@ void MainWindow::mousePressEvent(QMouseEvent *eventPress) // event triggered by
             return;
         }
         else if (loaded) {
-            int row = ui->listWidget_labels->currentRow(); // get current label number in list
-            if (mouseButton == Qt::LeftButton) { // left mouse button ?
+            int row = CurrentLabelRow(); // get current label number in list
+            if ((mouseButton == Qt::LeftButton) & (row >= 0)) { // left mouse button ?
+                grayGradient gradient = labelsList.Gradient(row); // gradient of current label
                 int size;
                 if (zoom < 1)
                     size = 1.0 / zoom * 6;
                 else
                     size = zoom * 6;
-                if ((pos.x >= gradients[row].endPoint.x - size - 1) & (pos.y >= gradients[row].endPoint.y - size - 1)
-                         & (pos.x <= gradients[row].endPoint.x + size + 1) & (pos.y <= gradients[row].endPoint.y + size + 1)) { // mouse cursor over end point
+                if ((pos.x >= gradient.endPoint.x - size - 1) & (pos.y >= gradient.endPoint.y - size - 1)
+                         & (pos.x <= gradient.endPoint.x + size + 1) & (pos.y <= gradient.endPoint.y + size + 1)) { // mouse cursor over end point
                      moveEnd = true; // begin moving it
                 }
-                else if ((pos.x >= gradients[row].beginPoint.x - size - 1) & (pos.y >= gradients[row].beginPoint.y - size - 1)
-                      & (pos.x <= gradients[row].beginPoint.x + size + 1) & (pos.y <= gradients[row].beginPoint.y + size + 1)) { // mouse cursor over begin point
+                else if ((pos.x >= gradient.beginPoint.x - size - 1) & (pos.y >= gradient.beginPoint.y - size - 1)
+                      & (pos.x <= gradient.beginPoint.x + size + 1) & (pos.y <= gradient.beginPoint.y + size + 1)) { // mouse cursor over begin point
                     moveBegin = true; // begin moving it
 
                 }
                 else if ((pos.x >= 0) & (pos.x < image.cols)
                          & (pos.y >= 0) & (pos.y < image.rows)) { // select label in viewport
-                    int value = labels.at<int>(pos.y, pos.x); // get label mask value under mouse cursor
-                    for (int i = 0; i < ui->listWidget_labels->count(); i++) { // find clicked label id
-                        QListWidgetItem *item = ui->listWidget_labels->item(i); // pointer on item
-                        if (item->data(Qt::UserRole).toInt() == value) { // is it the right one ?
-                            ui->listWidget_labels->setCurrentRow(i); // yes, select label in list, it will trigger actions
-                            break; // fount it, exit
-                        }
-                    }
+                    int value = LabelAt(labels, pos.y, pos.x); // get label mask value under mouse cursor
+                    int clicked = labelsList.Row(value); // find clicked label id
+                    if (clicked >= 0)
+                        SetCurrentLabelRow(clicked); // select label in list, it will trigger actions
                 }
         }
         }
@@ -1765,14 +2126,12 @@ void MainWindow::mouseMoveEvent(QMouseEvent *eventMove) // first mouse click has
         if (pos.y > image.rows-2) pos.y = image.rows - 2;
 
         if (moveBegin) { // move base of label vector
-            int row = ui->listWidget_labels->currentRow(); // get current label
-            gradients[row].beginPoint = pos; // set new pos in gradients array
-            ChangeLabelGradient(); // change gradient in depthmap
+            labelsList.SetBeginPoint(CurrentLabelRow(), pos); // set new pos in gradients array
+            ScheduleLabelGradient(); // change gradient in depthmap, only the last position counts
         }
         else if (moveEnd) { // same comment as before, except this is for head of label vector
-            int row = ui->listWidget_labels->currentRow();
-            gradients[row].endPoint = pos;
-            ChangeLabelGradient();
+            labelsList.SetEndPoint(CurrentLabelRow(), pos);
+            ScheduleLabelGradient();
         }
         else if ((mouseButton == Qt::MiddleButton) & (pos.x >= 0) & (pos.x < image.cols)
                                                   & (pos.y >= 0) & (pos.y < image.rows)) { // show gray "color" under mouse cursor
@@ -1932,7 +2291,7 @@ void MainWindow::Render() // show masks for image + depthmap + selection
         Mat selection_temp;
         selection.copyTo(selection_temp); // make a copy of selection mask
 
-        int row = ui->listWidget_labels->currentRow(); // get current label row in list
+        grayGradient gradient = labelsList.Gradient(CurrentLabelRow()); // gradient of current label
 
         // draw end point : a blue tiny rectangle crossed by diagonals
         int size;
@@ -1940,29 +2299,29 @@ void MainWindow::Render() // show masks for image + depthmap + selection
             size = 1.0 / zoom * 6;
         else
             size = zoom * 6;
-        cv::rectangle(selection_temp, Rect(gradients[row].endPoint.x - size, gradients[row].endPoint.y - size, size * 2 + 1, size * 2 + 1),
+        cv::rectangle(selection_temp, Rect(gradient.endPoint.x - size, gradient.endPoint.y - size, size * 2 + 1, size * 2 + 1),
                       Vec3b(255, 0, 0), 2);
-        cv::line(selection_temp, cv::Point(gradients[row].endPoint.x - size, gradients[row].endPoint.y - size),
-                              cv::Point(gradients[row].endPoint.x + size, gradients[row].endPoint.y + size),
+        cv::line(selection_temp, cv::Point(gradient.endPoint.x - size, gradient.endPoint.y - size),
+                              cv::Point(gradient.endPoint.x + size, gradient.endPoint.y + size),
                               Vec3b(255, 0, 0), 2);
-        cv::line(selection_temp, cv::Point(gradients[row].endPoint.x - size, gradients[row].endPoint.y + size),
-                              cv::Point(gradients[row].endPoint.x + size, gradients[row].endPoint.y - size),
+        cv::line(selection_temp, cv::Point(gradient.endPoint.x - size, gradient.endPoint.y + size),
+                              cv::Point(gradient.endPoint.x + size, gradient.endPoint.y - size),
                               Vec3b(255, 0, 0), 2);
         // draw begin point : a red tiny rectangle crossed by diagonals
-        cv::rectangle(selection_temp, Rect(gradients[row].beginPoint.x - size, gradients[row].beginPoint.y - size, size * 2 + 1, size * 2 + 1),
+        cv::rectangle(selection_temp, Rect(gradient.beginPoint.x - size, gradient.beginPoint.y - size, size * 2 + 1, size * 2 + 1),
                       Vec3b(0, 0, 255), 2);
-        cv::line(selection_temp, cv::Point(gradients[row].beginPoint.x - size, gradients[row].beginPoint.y - size),
-                              cv::Point(gradients[row].beginPoint.x + size, gradients[row].beginPoint.y + size),
+        cv::line(selection_temp, cv::Point(gradient.beginPoint.x - size, gradient.beginPoint.y - size),
+                              cv::Point(gradient.beginPoint.x + size, gradient.beginPoint.y + size),
                               Vec3b(0, 0, 255), 2);
-        cv::line(selection_temp, cv::Point(gradients[row].beginPoint.x - size, gradients[row].beginPoint.y + size),
-                              cv::Point(gradients[row].beginPoint.x + size, gradients[row].beginPoint.y - size),
+        cv::line(selection_temp, cv::Point(gradient.beginPoint.x - size, gradient.beginPoint.y + size),
+                              cv::Point(gradient.beginPoint.x + size, gradient.beginPoint.y - size),
                               Vec3b(0, 0, 255), 2);
         Vec3b CO; // color of vector
         if ((moveBegin) | (moveEnd)) // is it being moved ?
             CO = Vec3b(0, 255, 0); // yes = green
         else
             CO = Vec3b(255, 255, 255); // no = white
-        cv::arrowedLine(selection_temp, gradients[row].beginPoint, gradients[row].endPoint, CO, 1, 8, 0, 0.2); // draw vector
+        cv::arrowedLine(selection_temp, gradient.beginPoint, gradient.endPoint, CO, 1, 8, 0, 0.2); // draw vector
 
         selection_temp = CopyFromImage(selection_temp, viewport); // only keep the view part of selection mask
         if (zoom <= 1) selection_temp = DilatePixels(selection_temp, int(1/zoom)); // dilation depends of zoom
@@ -1981,8 +2340,26 @@ void MainWindow::Render() // show masks for image + depthmap + selection
     if ((computeVertices3D | updateVertices3D | computeColors3D) & (ui->checkBox_3d_realtime->isChecked())) { // need to update 3D view ?
         if (updateVertices3D) {
             updateVertices3D = false;
-            //ui->openGLWidget_3d->area3D = selection_rect;
-            //ui->openGLWidget_3d->mask3D = currentLabelMask;
+            int label = dirtyLabel3D; // one label changed : only its runs are sent
+            if (ui->openGLWidget_3d->updateVertices3D) { // previous update not drawn yet : add the new area
+                ui->openGLWidget_3d->area3D |= dirty3D;
+                if (label != label3D) // not the same label : use the rectangle
+                    label = -1;
+            }
+            else
+                ui->openGLWidget_3d->area3D = dirty3D; // only the part of depthmap that changed
+
+            labelRunsIndex::const_iterator runs = labelsRuns.find(label);
+            if ((label < 0) || (runs == labelsRuns.end())) { // several labels or the whole depthmap
+                label = -1;
+                ui->openGLWidget_3d->runs3D.clear();
+            }
+            else if (label != label3D) // runs of another label
+                ui->openGLWidget_3d->runs3D = runs->second;
+            label3D = label;
+
+            dirty3D = Rect();
+            dirtyLabel3D = -1;
             ui->openGLWidget_3d->updateVertices3D = true; // 3D scene vertices must change
         }
         if (computeVertices3D) {
@@ -2000,14 +2377,357 @@ void MainWindow::Render() // show masks for image + depthmap + selection
 
 void MainWindow::ChangeLabelGradient() // update depthmap mask with gradient
 {
-    int row = ui->listWidget_labels->currentRow(); // get current label row in list
+    int row = CurrentLabelRow(); // get current label row in list
+    if (row < 0) // no current label
+        return;
+    int id = labelsList.Id(row); // label id
+
+    grayGradient gradient = labelsList.Gradient(row); // copies for the worker : the GUI can change them meanwhile
+    labelRuns runs = currentLabelRuns;
+
+    JournalGradient(id, gradient); // keep the edit even if the application crashes
+
+    QueueDepthmapJob(id, [gradient, runs](Mat &back) {
+        GradientFillGray(gradient.gradient, back, runs,
+                         gradient.beginPoint, gradient.endPoint,
+                         gradient.beginColor, gradient.endColor,
+                         gradient.curve); // fill depthmap label runs with gradient
+        return LabelRunsBoundingRect(runs); // only the label changed
+    });
+}
+
+void MainWindow::ScheduleLabelGradient() // ask for a gradient update while dragging handles
+    // mouse events only change the gradient points, the timer computes the gradient with the newest ones
+    // if computing takes longer than a frame the queued mouse events are treated before the timer fires, so superseded positions are never computed
+{
+    gradientPending = true;
+    if (!gradientTimer.isActive()) // no update planned yet : compute one at the next frame - if one is already planned it will use the new points
+        gradientTimer.start();
+}
+
+void MainWindow::FlushLabelGradient() // compute the gradient asked by ScheduleLabelGradient, if any
+{
+    gradientTimer.stop();
+    if (!gradientPending) // nothing new
+        return;
+
+    gradientPending = false;
+    ChangeLabelGradient();
+}
+
+void MainWindow::RebuildAllLabels() // fill the whole depthmap from the gradients of all labels
+{
+    std::vector<int> ids(labelsList.Ids()); // label id of each gradient
+    std::vector<grayGradient> gradients_temp(labelsList.Gradients()); // gradients of all labels
+
+    Mat labels_temp = labels; // the worker only reads labels, and they are not replaced before ResetDepthmapJobs
+    QueueDepthmapJob(-1, [ids, gradients_temp, labels_temp](Mat &back) {
+        RebuildDepthmap(back, labels_temp, ids, gradients_temp); // only one pass on the whole image
+        return Rect(0, 0, back.cols, back.rows); // all pixels changed
+    });
+}
+
+/////////////////// Depthmap worker //////////////////////
+
+// depthmap edits (gradients, rebuilds) are computed by a worker thread in a back buffer, while depthmap stays displayed
+// when an edit is done both buffers are swapped, and only the area that changed is sent to the 3D view
+// edits are computed one at a time and in order, so the back buffer only has to catch up with the last edit before the next one
+
+void MainWindow::QueueDepthmapJob(const int &key, const depthmapJobFunction &fill) // edit depthmap in the background
+{
+    if (key < 0) // the whole depthmap is rewritten : waiting edits are useless
+        depthmapJobs.clear();
+    else if ((!depthmapJobs.empty()) && (depthmapJobs.back().key == key)) { // same label as the last waiting edit : only the newest counts
+        depthmapJobs.back().fill = fill;
+        return;
+    }
 
-    GradientFillGray(gradients[row].gradient, depthmap, currentLabelMask,
-                     gradients[row].beginPoint, gradients[row].endPoint,
-                     gradients[row].beginColor, gradients[row].endColor,
-                     gradients[row].curve, selection_rect); // fill depthmap mask with gradient
+    depthmapJob job;
+    job.key = key;
+    job.fill = fill;
+    depthmapJobs.push_back(job);
+
+    StartDepthmapJob(); // maybe the worker is free
+}
+
+void MainWindow::StartDepthmapJob() // give the next queued edit to the worker
+{
+    if ((depthmapJobRunning) || (depthmapJobs.empty())) // busy or nothing to do
+        return;
+
+    depthmapJobFunction fill = depthmapJobs.front().fill;
+    depthmapJobKey = depthmapJobs.front().key;
+    depthmapJobs.pop_front();
+
+    Mat front = depthmap; // depthmap is only read while the worker runs
+    Rect stale = depthmapBackStale;
+    if ((saveDepthmapData != NULL) && (depthmapBack.data == saveDepthmapData)) // copy-on-write : this buffer is still read by a session save
+        depthmapBack.release(); // the save keeps it, the worker gets a new one
+    if ((depthmapBack.size() != depthmap.size()) || (depthmapBack.type() != depthmap.type())) { // no back buffer yet
+        depthmapBack.create(depthmap.size(), depthmap.type());
+        stale = Rect(0, 0, depthmap.cols, depthmap.rows); // copy everything
+    }
+    Mat back = depthmapBack;
+    depthmapBackStale = Rect();
+
+    depthmapJobRunning = true;
+    depthmapWatcher.setFuture(QtConcurrent::run([front, back, stale, fill]() {
+        Mat b = back;
+        if (stale.area() > 0) // catch up with the last edit
+            front(stale).copyTo(b(stale));
+        return fill(b);
+    }));
+}
+
+void MainWindow::DepthmapJobFinished() // the worker has filled the back buffer : swap it with depthmap
+{
+    if (!depthmapJobRunning) // already done by FinishDepthmapJobs, or forgotten by ResetDepthmapJobs
+        return;
+    depthmapJobRunning = false;
+
+    Rect dirty = depthmapWatcher.result() & Rect(0, 0, depthmap.cols, depthmap.rows); // area changed by the worker
+    cv::swap(depthmap, depthmapBack); // only the headers are exchanged
+    depthmapBackStale = dirty; // the old depthmap doesn't have this edit
+    depthmapVersion++;
 
     ui->openGLWidget_3d->depthmap3D = depthmap;
+    blurVersion3D = -1; // edits are shown without blur
+    if (dirty3D.area() == 0) // nothing waiting for the 3D view : the runs of this label are enough, if it is a label
+        dirtyLabel3D = depthmapJobKey;
+    else if (dirtyLabel3D != depthmapJobKey) // another label is waiting too : use the rectangle
+        dirtyLabel3D = -1;
+    dirty3D |= dirty;
     updateVertices3D = true;
+
+    StartDepthmapJob(); // next edit, if any
     Render(); // update view
 }
+
+void MainWindow::FinishDepthmapJobs() // wait until all queued edits are in depthmap
+{
+    while (depthmapJobRunning) {
+        depthmapWatcher.waitForFinished();
+        DepthmapJobFinished(); // swap now and start the next edit
+    }
+}
+
+void MainWindow::ResetDepthmapJobs() // forget queued edits and back buffer, before depthmap is replaced
+{
+    gradientTimer.stop(); // a gradient waiting for the timer is forgotten too
+    gradientPending = false;
+    depthmapJobs.clear();
+    depthmapWatcher.waitForFinished(); // the worker can't be stopped : let it finish, but ignore its result
+    depthmapJobRunning = false;
+    depthmapBack.release();
+    depthmapBackStale = Rect();
+    dirty3D = Rect();
+    dirtyLabel3D = -1;
+    label3D = -1; // labels may change : runs are given again to the 3D view
+
+    blurPending = false;
+    blurWatcher.waitForFinished();
+    blurJobRunning = false; // its result is ignored
+    depthmapVersion++;
+    blurVersion3D = -1;
+}
+
+void MainWindow::StartBlurJob() // blur depthmap for the 3D view in the background
+{
+    if ((!blurPending) || (blurJobRunning)) // nothing to do, or wait for the current blur
+        return;
+    blurPending = false;
+
+    Mat source = depthmap.clone(); // depthmap may become the back buffer while blurring
+    int size = ui->horizontalSlider_blur_amount->value() * 2 + 1;
+    blurJobVersion = depthmapVersion;
+    blurJobSize = size;
+    blurJobRunning = true;
+    blurWatcher.setFuture(QtConcurrent::run([source, size]() {
+        Mat blurred;
+        cv::GaussianBlur(source, blurred, Size(size, size), 0, 0); // gaussian blur image
+        return blurred;
+    }));
+}
+
+void MainWindow::BlurJobFinished() // the worker has blurred the depthmap for the 3D view
+{
+    if (!blurJobRunning) // already done by FinishBlurJob, or forgotten by ResetDepthmapJobs
+        return;
+    blurJobRunning = false;
+
+    Mat blurred = blurWatcher.result();
+
+    if ((ui->checkBox_3d_blur->isChecked()) && (blurred.size() == depthmap.size())) // still wanted
+        SetBlurredDepthmap3D(blurred, blurJobVersion, blurJobSize);
+
+    StartBlurJob(); // blur amount changed meanwhile ?
+}
+
+void MainWindow::FinishBlurJob() // wait until the 3D view has the blurred depthmap, if blur is on
+{
+    while (blurJobRunning) {
+        blurWatcher.waitForFinished();
+        BlurJobFinished(); // apply it now and start the next blur
+    }
+
+    if (!ui->checkBox_3d_blur->isChecked()) // no blur wanted
+        return;
+
+    int size = ui->horizontalSlider_blur_amount->value() * 2 + 1;
+    if ((blurVersion3D == depthmapVersion) && (blurSize3D == size)) // the 3D view already has it
+        return;
+
+    Mat blurred; // depthmap changed since the last blur : blur it now
+    cv::GaussianBlur(depthmap, blurred, Size(size, size), 0, 0);
+    SetBlurredDepthmap3D(blurred, depthmapVersion, size);
+}
+
+void MainWindow::SetBlurredDepthmap3D(const Mat &blurred, const int &version, const int &size) // give a blurred depthmap to the 3D view
+{
+    ui->openGLWidget_3d->depthmap3D = blurred; // copy blurred depthmap
+    blurVersion3D = version;
+    blurSize3D = size;
+    ui->openGLWidget_3d->updateVertices3D = true; // recompute 3D scene
+    ui->openGLWidget_3d->updateAllVertices3D = true; // for all image
+    ui->openGLWidget_3d->update(); // view 3D scene
+}
+
+/////////////////// Label shapes cache //////////////////////
+
+// masks and contours of labels only depend on the labels image, so they are computed once and kept until labels change
+// after loading a worker computes them all, and a label not computed yet when it is selected is computed right away
+
+labelShape MainWindow::GetLabelShape(const int &id) // cached shape of a label, computed if needed
+{
+    {
+        std::lock_guard<std::mutex> lock(labelShapesMutex);
+        std::unordered_map<int, labelShape>::const_iterator found = labelShapes.find(id);
+        if (found != labelShapes.end()) // already computed
+            return found->second;
+    }
+
+    labelRunsIndex::const_iterator runs = labelsRuns.find(id); // runs of pixels of this label
+    labelShape shape = LabelRunsShape((runs != labelsRuns.end()) ? runs->second : labelRuns());
+
+    std::lock_guard<std::mutex> lock(labelShapesMutex);
+    labelShapes[id] = shape; // keep it for next time
+    return shape;
+}
+
+void MainWindow::StartLabelShapes() // compute the shapes of all labels in the background
+{
+    labelShapesCancel = false;
+    const labelRunsIndex* runs = &labelsRuns; // not changed before ResetLabelShapes has stopped the worker
+
+    labelShapesFuture = QtConcurrent::run([this, runs]() {
+        for (labelRunsIndex::const_iterator it = runs->begin(); (it != runs->end()) && (!labelShapesCancel); ++it) {
+            {
+                std::lock_guard<std::mutex> lock(labelShapesMutex);
+                if (labelShapes.count(it->first) > 0) // already computed for the GUI
+                    continue;
+            }
+            labelShape shape = LabelRunsShape(it->second);
+            std::lock_guard<std::mutex> lock(labelShapesMutex);
+            labelShapes.insert(std::make_pair(it->first, shape));
+        }
+    });
+}
+
+void MainWindow::ResetLabelShapes() // forget all shapes, before labels change
+{
+    labelShapesCancel = true; // stop the worker
+    labelShapesFuture.waitForFinished();
+    labelShapesCancel = false;
+
+    std::lock_guard<std::mutex> lock(labelShapesMutex);
+    labelShapes.clear();
+}
+
+/////////////////// Edits journal //////////////////////
+
+// each gradient edit is appended to a journal file next to the session : a few bytes instead of saving the whole session
+// when a session is loaded its journal is applied on top of it, so nothing is lost if the application crashes before a save
+// the journal is compacted (one edit per label) when it grows too much, and after each save (only edits made during the save remain)
+
+bool MainWindow::OpenJournal(const std::string &filename) // open the journal of a session and apply its edits to the labels list - true if there were edits
+{
+    CloseJournal(); // journal of the previous session
+
+    std::vector<journalRecord> edits;
+    QFile file(QString::fromStdString(filename));
+    if (file.open(QIODevice::ReadOnly)) { // no journal = nothing edited since the last save
+        edits = DecodeJournal(file.readAll());
+        file.close();
+    }
+
+    for (size_t n = 0; n < edits.size(); n++) { // in order : the last edit of each label wins
+        int row = labelsList.Row(edits[n].id);
+        if (row < 0) // not a label of this session
+            continue;
+        labelsList.SetGradient(row, edits[n].gradient);
+        journalIds.insert(edits[n].id);
+    }
+
+    CompactJournal(filename); // start the journal : also repairs a damaged file
+
+    return !journalIds.empty();
+}
+
+void MainWindow::JournalGradient(const int &id, const grayGradient &gradient) // append a gradient edit to the journal
+{
+    if (!journal.isOpen()) // no session file
+        return;
+
+    journal.write(EncodeJournalRecord(id, gradient));
+    journal.flush(); // in the file now, not when Qt decides
+    journalIds.insert(id);
+    journalRecords++;
+
+    if (journalRecords > 4 * int(journalIds.size() + saveJournalIds.size()) + 1024) // mostly superseded edits
+        CompactJournal(journal.fileName().toStdString());
+}
+
+void MainWindow::CompactJournal(const std::string &filename) // rewrite the journal with only the last edit of each label
+{
+    std::string previous = journal.fileName().toStdString(); // maybe another file : the journal moves with a "save as"
+    journal.close();
+
+    QSaveFile file(QString::fromStdString(filename)); // the old journal is replaced only when the new one is complete
+    if (file.open(QIODevice::WriteOnly)) {
+        int records = 0;
+        file.write(EncodeJournalHeader());
+        for (const int &id : journalIds) { // current gradient of each edited label
+            int row = labelsList.Row(id);
+            if (row >= 0) {
+                file.write(EncodeJournalRecord(id, labelsList.Gradient(row)));
+                records++;
+            }
+        }
+        for (const int &id : saveJournalIds) // edits in the save in flight : still needed if it fails
+            if (journalIds.count(id) == 0) {
+                int row = labelsList.Row(id);
+                if (row >= 0) {
+                    file.write(EncodeJournalRecord(id, labelsList.Gradient(row)));
+                    records++;
+                }
+            }
+        if (file.commit()) {
+            journalRecords = records;
+            if ((!previous.empty()) && (previous != filename)) // edits of the old journal are in the saved session
+                QFile::remove(QString::fromStdString(previous));
+        }
+    }
+
+    journal.setFileName(QString::fromStdString(filename));
+    journal.open(QIODevice::WriteOnly | QIODevice::Append); // edits are appended from now on
+}
+
+void MainWindow::CloseJournal() // no session : no journal
+{
+    journal.close();
+    journal.setFileName(QString());
+    journalIds.clear();
+    saveJournalIds.clear();
+    journalRecords = 0;
+    saveJournalFile.clear(); // a save in flight belongs to another session now
+}
@@ -23,8 +23,19 @@
 #include <QFileDialog>
 #include <QButtonGroup>
 #include <QListWidgetItem>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <QProgressDialog>
+#include <QFile>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_set>
 
 #include "mat-image-tools.h"
+#include "labelsmodel.h"
 
 namespace Ui {
 class MainWindow;
@@ -49,7 +60,7 @@ private slots:
     void AddCurveItem(const QString &title, const QColor &color, const QString &tip);
 
     //// labels
-    void on_listWidget_labels_currentItemChanged(QListWidgetItem *currentItem); // show current label color when item change
+    void CurrentLabelChanged(const QModelIndex &current); // show current label color when item change
 
     //// load & save
     void ChangeBaseDir(QString filename); // Set base dir and file
@@ -79,6 +90,10 @@ private slots:
     void on_horizontalSlider_begin_valueChanged(int value);
     void on_horizontalSlider_end_valueChanged(int value);
     void on_listWidget_gradient_curve_currentItemChanged(QListWidgetItem *currentItem);
+    void FlushLabelGradient(); // compute the last gradient asked while dragging its handles
+    void DepthmapJobFinished(); // the worker has filled the back buffer : swap it with depthmap
+    void BlurJobFinished(); // the worker has blurred the depthmap for the 3D view
+    void SaveSessionFinished(); // all files of the session are written, or something went wrong
 
     // Viewport
     void on_pushButton_zoom_minus_clicked(); // levels of zoom
@@ -100,6 +115,8 @@ private slots:
     void on_comboBox_3d_tint_currentIndexChanged(int index);
     void on_doubleSpinBox_gamma_valueChanged(double value);
     void on_horizontalSlider_depth3D_valueChanged(int value);
+    void on_doubleSpinBox_3d_mesh_error_valueChanged(double value);
+    void ShowMesh3D(int triangles, double error); // triangles and depth error of the 3D mesh
     void on_horizontalSlider_anaglyph_shift_valueChanged(int value);
     void on_horizontalSlider_blur_amount_valueChanged(int value);
     void on_button_3d_reset_clicked();
@@ -119,8 +136,10 @@ private:
     void InitializeValues();
 
     //// labels
-    int GetCurrentLabelNumber(); // label value for use with label_mask
     void DeleteAllLabels(); // delete ALL labels and create one new if wanted
+    int CurrentLabelRow(); // row of current label in the list, -1 if none
+    void SetCurrentLabelRow(const int &row); // change current label, it triggers CurrentLabelChanged
+    void BlockLabelsSignals(const bool &active); // block or not the current label signal
 
     //// Keyboard & mouse events
     void keyPressEvent(QKeyEvent *keyEvent); // for the create cell mode
@@ -143,6 +162,56 @@ private:
 
     void BlockGradientsSignals(const bool &active);
     void ChangeLabelGradient();
+    void ScheduleLabelGradient(); // ask for a gradient update, computed at most once per frame
+    void RebuildAllLabels(); // fill the whole depthmap from the gradients of all labels
+
+    //// Depthmap worker
+    typedef std::function<cv::Rect(cv::Mat &back)> depthmapJobFunction; // fills the back buffer and returns the area that changed
+    void QueueDepthmapJob(const int &key, const depthmapJobFunction &fill); // edit depthmap in the background
+    void StartDepthmapJob(); // give the next queued edit to the worker
+    void FinishDepthmapJobs(); // wait until all queued edits are in depthmap
+    void ResetDepthmapJobs(); // forget queued edits and back buffer, before depthmap is replaced
+    void StartBlurJob(); // blur depthmap for the 3D view in the background
+    void FinishBlurJob(); // wait until the 3D view has the blurred depthmap, if blur is on
+    void SetBlurredDepthmap3D(const cv::Mat &blurred, const int &version, const int &size); // give a blurred depthmap to the 3D view
+
+    //// Session save
+    enum saveFormat {save_png_fast, save_png, save_png_small, save_tiff, save_pfm, save_formats_count}; // codecs of the depthmap mask file
+    struct sessionSnapshot { // what is saved : copies of the session taken when save is clicked
+        std::string filesession; // base file name
+        saveFormat format; // depthmap mask codec
+        cv::Mat depthmap, image, labels; // data shared with the session, never written by it afterwards
+        std::string imageFile; // PNG file of image, copied instead of encoded - empty if none
+        std::vector<int> ids; // labels
+        std::vector<std::string> names;
+        std::vector<grayGradient> gradients;
+    };
+    struct saveResult { // what the save worker tells when it is done
+        QString error; // error message, empty if OK
+        qint64 bytes; // size of the session files
+        qint64 milliseconds; // time taken by the save
+    };
+    static saveResult SaveSessionFiles(const sessionSnapshot &snapshot, QProgressDialog *progress); // encode and write all files of a session, in a worker thread
+
+    //// Session load
+    struct sessionData { // XML file of a session, read by a worker thread
+        std::shared_ptr<cv::FileStorage> fs; // opened file, fields of each label are read afterwards
+        cv::Mat labels; // labels, already decoded
+        std::string labelsFile; // name of the labels binary file, empty for older sessions
+        QString errorTitle, error; // error message, empty if OK
+    };
+    void WaitForSessionFiles(const QList<QFuture<void>> &files, const QString &title); // wait for files decoded by worker threads, showing progress
+
+    //// Edits journal
+    bool OpenJournal(const std::string &filename); // open the journal of a session and apply its edits to the labels list - true if there were edits
+    void JournalGradient(const int &id, const grayGradient &gradient); // append a gradient edit to the journal
+    void CompactJournal(const std::string &filename); // rewrite the journal with only the last edit of each label
+    void CloseJournal(); // no session : no journal
+
+    //// Label shapes cache
+    labelShape GetLabelShape(const int &id); // cached shape of a label, computed if needed
+    void StartLabelShapes(); // compute the shapes of all labels in the background
+    void ResetLabelShapes(); // forget all shapes, before labels change
     void ShowGradient();
     void SetViewportXY(const int &x, const int &y); // change the origin of the viewport
     void UpdateViewportDimensions(); // calculate width and height of the viewport
@@ -153,12 +222,18 @@ private:
 
     cv::Mat labels; // Segmentation cells and labels
     int nbLabels; // max number of labels
+    labelRunsIndex labelsRuns; // runs of pixels of each label, computed once when labels are loaded
+    labelsModel labelsList; // ids, names and gradients of labels, shown in the labels list view
+    labelRuns currentLabelRuns; // runs of pixels of current label
+    std::unordered_map<int, labelShape> labelShapes; // cache of label masks and contours, by label id
+    std::mutex labelShapesMutex; // the cache is also filled by a worker thread
+    QFuture<void> labelShapesFuture; // worker computing all shapes
+    std::atomic<bool> labelShapesCancel; // tells the worker to stop
 
     cv::Mat image, // main image
             thumbnail, // thumbnail of main image
             depthmap, // gray-painted cells
-            selection, // selection mask
-            currentLabelMask; // for 3D partial update
+            selection; // selection mask
 
     cv::Rect selection_rect; // rectangle of current selection
 
@@ -179,19 +254,42 @@ private:
 
     bool loaded, computeVertices3D, updateVertices3D, computeColors3D; // indicators: image loaded & segmentation computed
     bool moveBegin, moveEnd;
-    bool abort_3d;
-    int saveXOpenGL, saveYOpenGL, saveWidthOpenGL, saveHeightOpenGL;
+    QTimer gradientTimer; // coalesces gradient updates while dragging handles
+    bool gradientPending; // a gradient update is waiting for the timer
 
-    struct struct_gradient{
-        cv::Point beginPoint;
-        cv::Point endPoint;
-        int beginColor;
-        int endColor;
-        gradientType gradient;
-        curveType curve;
+    struct depthmapJob { // an edit of depthmap waiting for the worker
+        int key; // label id, or -1 for the whole depthmap : a new job with the same key replaces the waiting one
+        depthmapJobFunction fill;
     };
-
-    struct_gradient gradients[1000];
+    std::deque<depthmapJob> depthmapJobs; // edits waiting for the worker, in order
+    QFutureWatcher<cv::Rect> depthmapWatcher; // edit being computed by the worker
+    bool depthmapJobRunning; // the worker is filling depthmapBack
+    cv::Mat depthmapBack; // back buffer : the worker writes here while depthmap is displayed
+    cv::Rect depthmapBackStale; // part of depthmapBack that differs from depthmap
+    cv::Rect dirty3D; // part of depthmap not yet sent to the 3D view
+    int depthmapJobKey; // key of the edit being computed by the worker
+    int dirtyLabel3D; // label whose runs hold all the changes of dirty3D, -1 = several labels or the whole depthmap
+    int label3D; // label whose runs were given to the 3D view, -1 = none : the rectangle is used
+    QFutureWatcher<cv::Mat> blurWatcher; // blurred depthmap being computed
+    bool blurPending; // a new blur is needed when the current one is done
+    bool blurJobRunning; // the worker is blurring depthmap
+    int blurJobVersion, blurJobSize; // depthmap version and blur size of the blur being computed
+    int depthmapVersion; // changes each time depthmap changes
+    int blurVersion3D, blurSize3D; // depthmap version and blur size of the depthmap given to the 3D view, -1 = not blurred
+    QFutureWatcher<saveResult> saveWatcher; // session being saved
+    const uchar* saveDepthmapData; // depthmap buffer read by the session being saved, NULL if none : the depthmap worker never writes in it
+    QProgressDialog *saveProgress; // progress of the save
+    QString saveBaseName, saveFileName; // names of the session being saved, for the final message
+    saveFormat saveFormatUsed; // codec chosen for the last save, proposed again for the next one
+    std::string imageFile; // PNG file holding image as it is, to copy it when saving instead of encoding it - empty if none
+    std::string saveImageFile; // image file of the session being saved
+    QFile journal; // gradient edits since the last save, appended after each change
+    std::unordered_set<int> journalIds; // labels edited in the journal
+    std::unordered_set<int> saveJournalIds; // labels edited before the save in flight : they are in the journal until the save is done
+    int journalRecords; // edits in the journal, to know when to compact it
+    std::string saveJournalFile; // journal of the session being saved
+    bool abort_3d;
+    int saveXOpenGL, saveYOpenGL, saveWidthOpenGL, saveHeightOpenGL;
 
 };
 
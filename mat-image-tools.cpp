@@ -9,8 +9,17 @@
 
 
 #include <QPixmap>
+#include <QFile>
+#include <QByteArray>
+#include <QtEndian>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <map>
+#include <mutex>
 
 #include "opencv2/opencv.hpp"
+#include "opencv2/core/hal/intrin.hpp"
 
 #include "mat-image-tools.h"
 
@@ -384,43 +393,368 @@ double PSNR(const Mat &source1, const Mat &source2) // noise difference between
 //// Gray gradients
 ///////////////////////////////////////////////////////////
 
-double GrayCurve(const int &color, const int &type, const int &begin, const int &range) // return a value transformed by a function
+// all gray curves must have continuous results in [0..1] range and have this shape : f(x) * range + begin
+// each curve is a specialization of GrayCurveShape, so that no switch is needed when a whole table is computed
+
+template <int type> static inline double GrayCurveShape(const int &color, const double &x, const int &begin, const int &range); // f(x) * range + begin for one curve type
+
+// good spread
+template <> inline double GrayCurveShape<curve_linear>(const int &color, const double &, const int &, const int &) { return color; } // linear -> the same color !
+// S-shaped
+template <> inline double GrayCurveShape<curve_cosinus2>(const int &, const double &x, const int &begin, const int &range) { return pow(cos(Pi / 2 - x * Pi/2), 2) * range + begin; } // cosinus² (better color gradient): f(x)=cos(pi/2-x*pi/2)²
+template <> inline double GrayCurveShape<curve_sigmoid>(const int &, const double &x, const int &begin, const int &range) { return 1.0 / (1 + exp(-5 * (2* (x) - 1))) * range + begin; } // sigmoid (S-shaped): f(x)=1/(1 + e(-5*(2x -1))
+// fast beginning
+template <> inline double GrayCurveShape<curve_cosinus>(const int &, const double &x, const int &begin, const int &range) { return cos(Pi / 2 - x * Pi/2) * range + begin; } // cosinus (more of end color): f(x)=cos(pi/2-x*pi/2)
+template <> inline double GrayCurveShape<curve_cos2sqrt>(const int &, const double &x, const int &begin, const int &range) { return pow(cos(Pi/2 - sqrt(x) * Pi/2), 2) * range + begin; } // cos²sqrt: f(x)=cos(pi/2−sqrt(x)*pi/2)²
+// fast ending
+template <> inline double GrayCurveShape<curve_power2>(const int &, const double &x, const int &begin, const int &range) { return pow(x, 2) * range + begin; } // power2 (more of begin color): f(x)=x²
+template <> inline double GrayCurveShape<curve_cos2power2>(const int &, const double &x, const int &begin, const int &range) { return pow(cos(Pi/2 - pow(x, 2) * Pi/2), 2) * range + begin; } // cos²power2: f(x)=cos(pi/2−x²∙pi/2)²
+template <> inline double GrayCurveShape<curve_power3>(const int &, const double &x, const int &begin, const int &range) { return pow(x, 3) * range + begin; } // power3 (even more of begin color): f(x)=x³
+// undulate
+template <> inline double GrayCurveShape<curve_undulate>(const int &color, const double &, const int &begin, const int &range) { return cos(double(color-begin) / 4 * Pi) * range + begin; } // undulate: f(x)=cos(x/4*pi)
+template <> inline double GrayCurveShape<curve_undulate2>(const int &color, const double &, const int &begin, const int &range) { return cos(pow(double(color-begin) * 2 * Pi/2 + 0.5, 2)) * range + begin; } // undulate²: f(x)=cos((x*2*pi)²) / 2 + 0.5
+template <> inline double GrayCurveShape<curve_undulate3>(const int &, const double &x, const int &begin, const int &range) { return (cos(Pi*Pi*pow(x+2.085,2))/(pow(x+2.085,3)+8)+(x+2.085)-2.11) * range + begin; } // undulate3: f(x) = cos(pi²∙(x+2.085)²) / ((x+2.085)³+10) + (x+2.085) − 2.11
+
+template <int type> static double GrayCurveType(const int &color, const int &begin, const int &range) // gray curve of one type
 {
-    // all functions must have continuous results in [0..1] range and have this shape : f(x) * range + begin
+    if (range == 0) return color; // faster this way
 
     double x = double(color-begin) / range; // x of f(x)
+    return GrayCurveShape<type>(color, x, begin, range);
+}
 
-    if (range == 0) return color; // faster this way
+template <int type> static void GrayCurveFill(uchar* table, const int &beginColor, const int &endColor) // the 256 gray levels of one curve type
+{
+    for (int color = 0; color < 256; color++)
+        table[color] = int(round(GrayCurveType<type>(color, beginColor, endColor - beginColor))); // same rounding as when computed for each pixel
+}
+
+typedef double (*grayCurveFunction)(const int &color, const int &begin, const int &range);
+typedef void (*grayCurveFillFunction)(uchar* table, const int &beginColor, const int &endColor);
+
+static const int grayCurvesCount = curve_undulate3 + 1; // number of curve types
+static const grayCurveFunction grayCurveFunctions[grayCurvesCount] = { // one function per curve type, same order as curveType
+    GrayCurveType<curve_linear>, GrayCurveType<curve_cosinus2>, GrayCurveType<curve_sigmoid>, GrayCurveType<curve_cosinus>,
+    GrayCurveType<curve_cos2sqrt>, GrayCurveType<curve_power2>, GrayCurveType<curve_cos2power2>, GrayCurveType<curve_power3>,
+    GrayCurveType<curve_undulate>, GrayCurveType<curve_undulate2>, GrayCurveType<curve_undulate3>};
+static const grayCurveFillFunction grayCurveFillFunctions[grayCurvesCount] = {
+    GrayCurveFill<curve_linear>, GrayCurveFill<curve_cosinus2>, GrayCurveFill<curve_sigmoid>, GrayCurveFill<curve_cosinus>,
+    GrayCurveFill<curve_cos2sqrt>, GrayCurveFill<curve_power2>, GrayCurveFill<curve_cos2power2>, GrayCurveFill<curve_power3>,
+    GrayCurveFill<curve_undulate>, GrayCurveFill<curve_undulate2>, GrayCurveFill<curve_undulate3>};
+
+double GrayCurve(const int &color, const int &type, const int &begin, const int &range) // return a value transformed by a function
+{
+    if ((type < 0) | (type >= grayCurvesCount)) // unknown curve
+        return color;
+
+    return grayCurveFunctions[type](color, begin, range);
+}
+
+Mat GrayCurveTable(const int &curve, const int &beginColor, const int &endColor) // gray curve applied to the 256 gray levels, cached
+{
+    static std::map<int, Mat> tables; // computed tables, key = (curve, begin color, end color)
+    static std::mutex tablesMutex; // the cache can be used by several threads
+
+    int key = (curve * 256 + beginColor) * 256 + endColor; // unique key for this curve
+    std::lock_guard<std::mutex> lock(tablesMutex);
+
+    std::map<int, Mat>::iterator found = tables.find(key); // already computed ?
+    if (found != tables.end())
+        return found->second; // yes, just share it
+
+    if (tables.size() >= 4096) // don't let the cache grow forever, 4096 tables = 1 MB
+        tables.clear();
+
+    Mat table(1, 256, CV_8UC1); // one value per gray level
+    if ((curve >= 0) & (curve < grayCurvesCount)) // curve chosen once for the whole table
+        grayCurveFillFunctions[curve](table.ptr<uchar>(), beginColor, endColor);
+    else // unknown curve = same color
+        for (int color = 0; color < 256; color++)
+            table.at<uchar>(color) = color;
+
+    tables[key] = table; // keep it for later
+    return table;
+}
+
+static inline uchar GrayCurveLookup(const uchar* table, const int &color, const int &curve, const int &beginColor, const int &endColor) // gray curve value using the lookup table
+{
+    if ((color >= 0) & (color < 256)) // should always be the case
+        return table[color];
+    else // but just in case compute it
+        return int(round(GrayCurve(color, curve, beginColor, endColor - beginColor)));
+}
+
+struct linearRamp { // everything needed to compute a linear gradient along image rows
+    int A, B; // gradient vector
+    int C1, C2; // "distances" of begin and end points
+    int beginColor, endColor, curve; // gray levels and gray curve
+    uchar table[258]; // gray curve lookup table, with begin color at index 0 and end color at index 257
+};
 
-    switch (type) {
-        // good spread
-        case curve_linear: return color; // linear -> the same color !
-        // S-shaped
-        case curve_cosinus2: return pow(cos(Pi / 2 - x * Pi/2), 2) * range + begin; // cosinus² (better color gradient): f(x)=cos(pi/2-x*pi/2)²
-        case curve_sigmoid: return 1.0 / (1 + exp(-5 * (2* (x) - 1))) * range + begin; // sigmoid (S-shaped): f(x)=1/(1 + e(-5*(2x -1))
-        // fast beginning
-        case curve_cosinus: return cos(Pi / 2 - x * Pi/2) * range + begin; // cosinus (more of end color): f(x)=cos(pi/2-x*pi/2)
-        case curve_cos2sqrt: return pow(cos(Pi/2 - sqrt(x) * Pi/2), 2) * range + begin; // cos²sqrt: f(x)=cos(pi/2−sqrt(x)*pi/2)²
-        // fast ending
-        case curve_power2: return pow(x, 2) * range + begin; // power2 (more of begin color): f(x)=x²
-        case curve_cos2power2: return pow(cos(Pi/2 - pow(x, 2) * Pi/2), 2) * range + begin; // cos²power2: f(x)=cos(pi/2−x²∙pi/2)²
-        case curve_power3: return pow(x, 3) * range + begin; // power3 (even more of begin color): f(x)=x³
-        // undulate
-        case curve_undulate: return cos(double(color-begin) / 4 * Pi) * range + begin; // undulate: f(x)=cos(x/4*pi)
-        case curve_undulate2: return cos(pow(double(color-begin) * 2 * Pi/2 + 0.5, 2)) * range + begin; // undulate²: f(x)=cos((x*2*pi)²) / 2 + 0.5
-        case curve_undulate3: return (cos(Pi*Pi*pow(x+2.085,2))/(pow(x+2.085,3)+8)+(x+2.085)-2.11) * range + begin; // undulate3: f(x) = cos(pi²∙(x+2.085)²) / ((x+2.085)³+10) + (x+2.085) − 2.11
-
-        //case 5: return sqrt(double(color-begin) / range) * range + begin;
+static void LinearRampInit(linearRamp &ramp, const Point &beginPoint, const Point &endPoint, const int &beginColor, const int &endColor,
+                           const int &curve, const uchar* lut) // prepare a linear gradient
+{
+    ramp.A = (endPoint.x - beginPoint.x); // horizontal difference
+    ramp.B = (endPoint.y - beginPoint.y); // vertical difference
+    ramp.C1 = ramp.A * beginPoint.x + ramp.B * beginPoint.y; // sort of euclidian distance, but no need to compute sqrt values
+    ramp.C2 = ramp.A * endPoint.x + ramp.B * endPoint.y;
+    ramp.beginColor = beginColor;
+    ramp.endColor = endColor;
+    ramp.curve = curve;
+    ramp.table[0] = beginColor;
+    memcpy(ramp.table + 1, lut, 256);
+    ramp.table[257] = endColor;
+}
+
+template <bool mirror> static inline uchar LinearRampColor(const linearRamp &ramp, int C) // gray level for a "distance"
+    // mirror = double linear gradient : pixels before begin point use the inverted vector
+{
+    if ((mirror) & (C < ramp.C1)) // double linear : before begin point the vector is inverted
+        C = 2 * ramp.C1 - C; // same "distance" on the other side of begin point
+
+    if (C <= ramp.C1) return ramp.beginColor; // before begin point : begin color
+        else if (C >= ramp.C2) return ramp.endColor; // after end point : end color
+            else return GrayCurveLookup(ramp.table + 1, float(ramp.beginColor * (ramp.C2 - C) + ramp.endColor * (C - ramp.C1))/(ramp.C2 - ramp.C1),
+                                        ramp.curve, ramp.beginColor, ramp.endColor); // C0 = percentage between begin and end colors, "shaped" by gray curve
+}
+
+template <bool mirror, bool masked> static void LinearRampRow(const linearRamp &ramp, uchar* dst, const uchar* msk, const int &row, const int &colBegin, const int &colEnd) // fill one image row with a linear gradient
+    // dst and msk point to the beginning of the row
+    // only pixels from colBegin to colEnd (excluded) with a non-zero mask are written - not masked = all pixels, msk is not used
+{
+    int col = colBegin;
+    int rowC = ramp.B * row; // "distance" of column 0
+
+#if CV_SIMD
+    const int nlanes = v_uint8::nlanes; // pixels computed at once
+    const int nlanes32 = v_int32::nlanes;
+
+    int CV_DECL_ALIGNED(CV_SIMD_WIDTH) indexes[nlanes]; // indexes in table for each pixel
+    int CV_DECL_ALIGNED(CV_SIMD_WIDTH) steps[nlanes32];
+    for (int n = 0; n < nlanes32; n++)
+        steps[n] = ramp.A * n; // "distance" increments inside a vector
+
+    v_int32 vSteps = vx_load_aligned(steps);
+    v_int32 vStride = vx_setall_s32(ramp.A * nlanes32); // "distance" increment between two vectors
+    v_int32 vC1 = vx_setall_s32(ramp.C1);
+    v_int32 vC2 = vx_setall_s32(ramp.C2);
+    v_int32 vBegin = vx_setall_s32(ramp.beginColor);
+    v_int32 vEnd = vx_setall_s32(ramp.endColor);
+    v_int32 vZero = vx_setzero_s32();
+    v_int32 vMax = vx_setall_s32(255);
+    v_int32 vOne = vx_setall_s32(1);
+    v_int32 vLast = vx_setall_s32(257);
+    v_float32 vRange = vx_setall_f32(float(ramp.C2 - ramp.C1));
+    v_uint8 vZero8 = vx_setzero_u8();
+    v_uint8 vAll8 = vx_setall_u8(255);
+
+    for (; col <= colEnd - nlanes; col += nlanes) { // vectors of pixels
+        v_uint8 vMask = vAll8; // pixels in mask
+        if (masked) {
+            vMask = vx_load(msk + col) != vZero8;
+            if (!v_check_any(vMask)) // nothing to do for these pixels
+                continue;
+        }
+
+        v_int32 vC = vx_setall_s32(rowC + ramp.A * col) + vSteps; // "distances" of the first pixels
+        v_int32 vOutside = vZero; // interpolated values that don't fit in the lookup table
+        for (int n = 0; n < 4; n++) { // 4 vectors of 32-bit values for one vector of 8-bit values
+            v_int32 vD = vC;
+            if (mirror) // double linear : inverted vector before begin point
+                vD = v_select(vC < vC1, vC1 + vC1 - vC, vC);
+            v_int32 vInside = (vD > vC1) & (vD < vC2); // pixels between begin and end points
+            v_int32 vColor = v_trunc(v_cvt_f32(vBegin * (vC2 - vD) + vEnd * (vD - vC1)) / vRange); // same computation as LinearRampColor
+            vOutside = vOutside | (vInside & ((vColor < vZero) | (vColor > vMax)));
+            v_int32 vIndex = v_select(vD >= vC2, vLast, vColor + vOne); // after end point = end color
+            vIndex = v_select(vD <= vC1, vZero, vIndex); // before begin point = begin color
+            v_store_aligned(indexes + n * nlanes32, vIndex);
+            vC += vStride;
+        }
+
+        if (v_check_any(vOutside)) { // at least one value doesn't fit in the table : compute these pixels the normal way
+            for (int n = col; n < col + nlanes; n++)
+                if ((!masked) || (msk[n] != 0))
+                    dst[n] = LinearRampColor<mirror>(ramp, rowC + ramp.A * n);
+            continue;
+        }
+
+        v_uint8 vColors = vx_lut(ramp.table, indexes); // gray levels from the lookup table
+        if (masked)
+            v_store(dst + col, v_select(vMask, vColors, vx_load(dst + col))); // only write pixels in mask
+        else
+            v_store(dst + col, vColors);
     }
+#endif
 
-    return color;
+    for (; col < colEnd; col++) // remaining pixels
+        if ((!masked) || (msk[col] != 0)) // non-zero pixel in mask
+            dst[col] = LinearRampColor<mirror>(ramp, rowC + ramp.A * col); // set grayscale to image, using the "distance" for this pixel
 }
 
-float EuclideanDistance(Point center, Point point, int radius){ // return distance between 2 points
-    float distance = sqrt(std::pow(center.x - point.x, 2) + std::pow(center.y - point.y, 2));
+struct gradientFill;
+typedef void (*gradientRowFunction)(const gradientFill &fill, uchar* dst, const uchar* msk, const int &row, const int &colBegin, const int &colEnd);
+
+struct gradientFill { // a gradient ready to fill image rows
+    int gradient_type; // gradient type
+    gradientRowFunction fillRow, fillRowMasked; // row kernels for this gradient type, without and with a mask
+    int beginColor, endColor, curve; // gray levels and gray curve
+    Mat curveTable; // gray curve lookup table
+    linearRamp ramp; // linear and double linear gradients
+    Point center; // radial gradients : center of the circles
+    float radius; // radial gradients : maximum distance
+    std::vector<int64> stepStart; // radial gradients : squared distances where the gray level changes
+    std::vector<uchar> stepColor; // radial gradients : gray level from each of these squared distances
+};
+
+static inline int RadialColor(const gradientFill &fill, const int64 &distance2) // gray level before curve for a squared distance to the center
+{
+    float distance = std::sqrt(double(distance2)); // euclidian distance
+    int maxDistance = fill.radius; // no value beyond radius
+    if (distance > maxDistance) distance = maxDistance;
 
-    if (distance > radius) return radius; // no value beyond radius
-        else return distance;
+    return fill.beginColor + distance / fill.radius * (fill.endColor - fill.beginColor); // distance percentage
+}
+
+static void RadialSteps(gradientFill &fill) // find all squared distances where the gray level changes
+    // the gray level only depends on the squared distance to the center and never goes back, so the few distances where it changes are enough
+{
+    const uchar* lut = fill.curveTable.ptr<uchar>();
+    int maxDistance = fill.radius;
+    int64 last = int64(maxDistance) * maxDistance; // gray level doesn't change anymore after radius
+
+    fill.stepStart.clear();
+    fill.stepColor.clear();
+
+    int64 start = 0; // first squared distance of current step
+    while (true) {
+        int color = RadialColor(fill, start); // gray level of this step
+        fill.stepStart.push_back(start);
+        fill.stepColor.push_back(GrayCurveLookup(lut, color, fill.curve, fill.beginColor, fill.endColor)); // "shaped" by gray curve
+
+        if (RadialColor(fill, last) == color) // last step ?
+            break;
+
+        int64 low = start, high = last; // the gray level changes between these squared distances
+        while (high - low > 1) { // binary search
+            int64 middle = low + (high - low) / 2;
+            if (RadialColor(fill, middle) == color)
+                low = middle;
+            else
+                high = middle;
+        }
+        start = high; // next step
+    }
+}
+
+// row kernels : fill part of a row with a gradient
+// dst and msk point to the beginning of the row
+// only pixels from colBegin to colEnd (excluded) with a non-zero mask are written - not masked = all pixels, msk is not used
+// one kernel per gradient type and mask use, so that there is no test in the loops that doesn't depend on the pixel
+
+template <bool masked> static void GradientFlatRow(const gradientFill &fill, uchar* dst, const uchar* msk, const int &, const int &colBegin, const int &colEnd) // flat = same color everywhere
+{
+    if (!masked) {
+        memset(dst + colBegin, fill.beginColor, colEnd - colBegin);
+        return;
+    }
+
+    for (int col = colBegin; col < colEnd; col++)
+        if (msk[col] != 0)
+            dst[col] = fill.beginColor;
+}
+
+template <bool mirror, bool masked> static void GradientLinearRow(const gradientFill &fill, uchar* dst, const uchar* msk, const int &row, const int &colBegin, const int &colEnd) // linear and double linear
+{
+    LinearRampRow<mirror, masked>(fill.ramp, dst, msk, row, colBegin, colEnd);
+}
+
+template <bool masked> static void GradientRadialRow(const gradientFill &fill, uchar* dst, const uchar* msk, const int &row, const int &colBegin, const int &colEnd) // squared distance computed incrementally along the row, no sqrt
+{
+    const int64* start = fill.stepStart.data();
+    const uchar* color = fill.stepColor.data();
+    int steps = int(fill.stepStart.size());
+
+    int64 dx = colBegin - fill.center.x; // horizontal distance to center
+    int64 dy = row - fill.center.y; // vertical distance to center
+    int64 distance2 = dx * dx + dy * dy; // squared distance of first pixel
+    int step = int(std::upper_bound(start, start + steps, distance2) - start) - 1; // gray level step of first pixel
+
+    for (int col = colBegin; col < colEnd; col++) {
+        if ((!masked) || (msk[col] != 0)) // non-zero pixel in mask
+            dst[col] = color[step]; // pixel in temp gradient mask = distance percentage, "shaped" by gray curve
+
+        distance2 += 2 * dx + 1; // (dx+1)² = dx² + 2dx + 1
+        dx++;
+        while ((step + 1 < steps) && (distance2 >= start[step + 1])) // getting away from center
+            step++;
+        while (distance2 < start[step]) // getting closer to center
+            step--;
+    }
+}
+
+static void GradientNoRow(const gradientFill &, uchar*, const uchar*, const int &, const int &, const int &) // unknown gradient type : nothing to fill
+{
+}
+
+static const gradientRowFunction gradientRowFunctions[4][2] = { // [gradient type][masked], same order as gradientType
+    {GradientFlatRow<false>, GradientFlatRow<true>},
+    {GradientLinearRow<false, false>, GradientLinearRow<false, true>},
+    {GradientLinearRow<true, false>, GradientLinearRow<true, true>},
+    {GradientRadialRow<false>, GradientRadialRow<true>}};
+
+static void GradientFillInit(gradientFill &fill, const int &gradient_type, const Point &beginPoint, const Point &endPoint,
+                             const int &beginColor, const int &endColor, const int &curve) // compute once what's needed by all rows
+{
+    fill.gradient_type = gradient_type;
+    if ((gradient_type >= gradient_flat) & (gradient_type <= gradient_radial)) { // row kernels chosen once for all rows
+        fill.fillRow = gradientRowFunctions[gradient_type][0];
+        fill.fillRowMasked = gradientRowFunctions[gradient_type][1];
+    }
+    else
+        fill.fillRow = fill.fillRowMasked = GradientNoRow;
+    fill.beginColor = beginColor;
+    fill.endColor = endColor;
+    fill.curve = curve;
+
+    if (gradient_type == gradient_flat) // flat gradients don't need anything more
+        return;
+
+    fill.curveTable = GrayCurveTable(curve, beginColor, endColor); // gray curve lookup table
+    const uchar* lut = fill.curveTable.ptr<uchar>();
+
+    switch (gradient_type) {
+        case (gradient_linear): { // grayscale is spread along the line, before begin point : begin color
+            LinearRampInit(fill.ramp, beginPoint, endPoint, beginColor, endColor, curve, lut);
+            break;
+        }
+        case (gradient_doubleLinear): { // double linear = linear, with the vector inverted before begin point
+            LinearRampInit(fill.ramp, beginPoint, endPoint, beginColor, endColor, curve, lut);
+            break;
+        }
+        case (gradient_radial): { // radial = concentric circles
+            fill.center = beginPoint;
+            fill.radius = std::sqrt(std::pow(beginPoint.x - endPoint.x, 2) + std::pow(beginPoint.y - endPoint.y, 2)); // maximum euclidian distance = vector length
+            RadialSteps(fill); // gray levels for all distances
+            break;
+        }
+    }
+}
+
+static void GradientParallel(const Range &range, const int &pixels, const std::function<void(const int &index)> &fill) // call fill for each index of range, with several threads if there are enough pixels
+{
+    const int minParallelPixels = 128 * 128; // under this number of pixels threads cost more than they save
+    const int stripePixels = 64 * 1024; // approximate number of pixels computed by one thread at a time
+
+    if (pixels < minParallelPixels) { // small area : just one thread
+        for (int index = range.start; index < range.end; index++)
+            fill(index);
+        return;
+    }
+
+    parallel_for_(range, [&](const Range &stripe) { // each thread gets a strip of rows or runs
+        for (int index = stripe.start; index < stripe.end; index++)
+            fill(index);
+    }, double(pixels) / stripePixels); // number of strips
 }
 
 void GradientFillGray(const int &gradient_type, Mat &img, const Mat &msk, const Point &beginPoint,
@@ -433,91 +767,449 @@ void GradientFillGray(const int &gradient_type, Mat &img, const Mat &msk, const
     if (area == Rect(0, 0, 0, 0)) // default area = 0
         area = Rect(0,0, img.cols, img.rows); // set it to image dimensions
 
-    switch (gradient_type) {
-        case (gradient_flat): { // flat = same color everywhere
-            img.setTo(beginColor, msk); // fill the mask with this color
-            return;
+    if (gradient_type == gradient_flat) { // flat = same color everywhere
+        img(area).setTo(beginColor, msk(area)); // fill the mask with this color
+        return;
+    }
+
+    gradientFill fill;
+    GradientFillInit(fill, gradient_type, beginPoint, endPoint, beginColor, endColor, curve);
+
+    GradientParallel(Range(area.y, area.y + area.height), area.area(), [&](const int &row) { // scan mask
+        fill.fillRowMasked(fill, img.ptr<uchar>(row), msk.ptr<uchar>(row), row, area.x, area.x + area.width);
+    });
+}
+
+void GradientFillGray(const int &gradient_type, Mat &img, const labelRuns &runs, const Point &beginPoint,
+                      const Point &endPoint, const int &beginColor, const int &endColor,
+                      const int &curve) // fill the runs of a label in a 1-channel image with gray gradients
+{
+    gradientFill fill;
+    GradientFillInit(fill, gradient_type, beginPoint, endPoint, beginColor, endColor, curve);
+
+    int pixels = 0; // number of pixels to fill
+    for (size_t n = 0; n < runs.size(); n++)
+        pixels += runs[n].colEnd - runs[n].colStart;
+
+    GradientParallel(Range(0, int(runs.size())), pixels, [&](const int &index) { // runs are independent
+        const labelRun &run = runs[index];
+        fill.fillRow(fill, img.ptr<uchar>(run.row), NULL, run.row, run.colStart, run.colEnd);
+    });
+}
+
+template <typename T, typename F> static inline void ScanLabelRowRuns(const T* l, const int &cols, F run) // call run(id, colStart, colEnd) for each run of the same label in a row
+{
+    int colStart = 0; // beginning of current run
+    for (int col = 1; col <= cols; col++)
+        if ((col == cols) || (l[col] != l[colStart])) { // end of row or label changed = end of run
+            run(int(l[colStart]), colStart, col);
+            colStart = col; // next run
         }
-        case (gradient_linear): { // grayscale is spread along the line
-            int A = (endPoint.x - beginPoint.x); // horizontal difference
-            int B = (endPoint.y - beginPoint.y); // vertical difference
-            int C1 = A * beginPoint.x + B * beginPoint.y; // sort of euclidian distance, but no need to compute sqrt values
-            int C2 = A * endPoint.x + B * endPoint.y;
-
-            float CO; // will contain color values
-
-            for (int row = area.y; row < area.y + area.height; row++) // scan mask
-                for (int col = area.x; col < area.x + area.width; col++)
-                    if (msk.at<uchar>(row, col) != 0) { // non-zero pixel in mask
-                        int C = A * col + B * row; // "distance" for this pixel
-
-                        if (C <= C1) CO = beginColor; // before begin point : begin color
-                            else if (C >= C2) CO = endColor; // after end point : end color
-                                else CO = round(GrayCurve(float(beginColor * (C2 - C) + endColor * (C - C1))/(C2 - C1),
-                                                    curve, beginColor, endColor - beginColor)); // C0 = percentage between begin and end colors, "shaped" by gray curve
-                        img.at<uchar>(row, col) = CO; // set grayscale to image
+}
+
+template <typename F> static inline void ScanLabelRow(const Mat &labels, const int &row, F run) // same thing for 16-bit and 32-bit labels
+{
+    if (labels.depth() == CV_16U)
+        ScanLabelRowRuns(labels.ptr<ushort>(row), labels.cols, run);
+    else
+        ScanLabelRowRuns(labels.ptr<int>(row), labels.cols, run);
+}
+
+void RebuildDepthmap(Mat &depthmap, const Mat &labels, const std::vector<int> &ids, const std::vector<grayGradient> &gradients) // fill all labels of depthmap with their gradients, in one pass
+    // ids[n] is the label id of gradients[n]
+    // pixels with a label id not in ids are not changed - an id found twice in ids uses its first gradient, like labelsModel
+{
+    depthmap.create(labels.rows, labels.cols, CV_8UC1); // depthmap must have the same size as labels
+    if (ids.empty())
+        return;
+
+    // label id -> gradient number, same rule as labelsModel : an array if ids are compact, a hash table if they are too spread
+    int minId = *std::min_element(ids.begin(), ids.end()); // range of label ids
+    int64 range = int64(*std::max_element(ids.begin(), ids.end())) - minId + 1;
+    std::vector<int> gradientOfId; // label id - minId -> gradient number, -1 = no gradient
+    std::unordered_map<int, int> gradientOfIdSparse; // label id -> gradient number, only used if ids are too spread for an array
+    if (range <= 4 * int64(ids.size()) + 1024) { // compact ids : dense array
+        gradientOfId.assign(range, -1);
+        for (int n = int(ids.size()) - 1; n >= 0; n--) // if an id is used twice the first gradient wins
+            gradientOfId[ids[n] - minId] = n;
+    }
+    else // very spread ids : hash table
+        for (int n = int(ids.size()) - 1; n >= 0; n--)
+            gradientOfIdSparse[ids[n]] = n;
+
+    std::vector<gradientFill> fills(gradients.size()); // prepare all gradients, each one only once
+    parallel_for_(Range(0, int(gradients.size())), [&](const Range &range) {
+        for (int n = range.start; n < range.end; n++)
+            GradientFillInit(fills[n], gradients[n].gradient, gradients[n].beginPoint, gradients[n].endPoint,
+                             gradients[n].beginColor, gradients[n].endColor, gradients[n].curve);
+    });
+
+    GradientParallel(Range(0, labels.rows), labels.rows * labels.cols, [&](const int &row) { // each row is cut in runs of the same label
+        uchar* dst = depthmap.ptr<uchar>(row);
+        ScanLabelRow(labels, row, [&](const int &id, const int &colStart, const int &colEnd) {
+            int n = -1; // gradient of this label id
+            if (!gradientOfId.empty()) { // dense array
+                int64 index = int64(id) - minId;
+                if ((index >= 0) & (index < range))
+                    n = gradientOfId[index];
+            }
+            else {
+                std::unordered_map<int, int>::const_iterator found = gradientOfIdSparse.find(id);
+                if (found != gradientOfIdSparse.end())
+                    n = found->second;
+            }
+            if (n >= 0) // known label id : fill the run with its gradient
+                fills[n].fillRow(fills[n], dst, NULL, row, colStart, colEnd);
+        });
+    });
+}
+
+///////////////////////////////////////////////////////////
+//// Label runs
+///////////////////////////////////////////////////////////
+
+labelRunsIndex IndexLabelRuns(const Mat &labels) // runs of pixels of all labels, in one pass
+{
+    labelRunsIndex index;
+
+    for (int row = 0; row < labels.rows; row++) // scan labels image
+        ScanLabelRow(labels, row, [&](const int &id, const int &colStart, const int &colEnd) {
+            labelRun run;
+            run.row = row;
+            run.colStart = colStart;
+            run.colEnd = colEnd;
+            index[id].push_back(run); // add this run to the label
+        });
+
+    return index;
+}
+
+Rect LabelRunsBoundingRect(const labelRuns &runs) // smallest rectangle containing all runs of a label
+{
+    if (runs.empty()) // no pixels
+        return Rect(0, 0, 0, 0);
+
+    int left = runs[0].colStart; // runs are sorted by row, so the first and last ones give top and bottom
+    int right = runs[0].colEnd;
+    for (size_t n = 1; n < runs.size(); n++) {
+        left = std::min(left, runs[n].colStart);
+        right = std::max(right, runs[n].colEnd);
+    }
+
+    return Rect(left, runs.front().row, right - left, runs.back().row - runs.front().row + 1);
+}
+
+void LabelRunsMask(const labelRuns &runs, Mat &mask, const Point &origin) // draw runs with 255 in a 1-channel mask whose top-left is at origin
+{
+    for (size_t n = 0; n < runs.size(); n++)
+        memset(mask.ptr<uchar>(runs[n].row - origin.y) + runs[n].colStart - origin.x, 255, runs[n].colEnd - runs[n].colStart);
+}
+
+Mat CompactLabels(const Mat &labels) // labels on 16 bits if all ids fit, else on 32 bits
+{
+    if (labels.empty())
+        return labels;
+
+    double minId, maxId;
+    minMaxLoc(labels, &minId, &maxId); // range of label ids
+
+    Mat compact;
+    if ((minId >= 0) && (maxId <= USHRT_MAX)) // fits in 16 bits : half the memory
+        labels.convertTo(compact, CV_16U);
+    else if (labels.depth() != CV_32S) // at least int
+        labels.convertTo(compact, CV_32S);
+    else // already int
+        compact = labels;
+
+    return compact;
+}
+
+int LabelAt(const Mat &labels, const int &row, const int &col) // label id of a pixel, 16-bit or 32-bit labels
+{
+    if (labels.depth() == CV_16U)
+        return labels.at<ushort>(row, col);
+    else
+        return labels.at<int>(row, col);
+}
+
+labelShape LabelRunsShape(const labelRuns &runs) // bounding rect, cropped mask and contours of a label
+{
+    labelShape shape;
+    shape.bounds = LabelRunsBoundingRect(runs); // rectangle containing the label
+    if (runs.empty()) // label not in image
+        return shape;
+
+    shape.mask = Mat::zeros(shape.bounds.height, shape.bounds.width, CV_8UC1); // label mask only the size of its rectangle
+    LabelRunsMask(runs, shape.mask, shape.bounds.tl());
+    findContours(shape.mask, shape.contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, shape.bounds.tl()); // contours in image coordinates
+
+    return shape;
+}
+
+struct labelSums { // partial sums of one label, for ComputeLabelStats
+    int64 pixels, sumX, sumY; // for the centroid
+    int left, top, right, bottom; // bounding rectangle, right and bottom included
+    int64 sumColor[3]; // for the mean color
+};
+
+labelStatsIndex ComputeLabelStats(const Mat &labels, const Mat &image) // pixel count, centroid, bounding rect and mean color of all labels, in one pass
+    // labels is 1-channel 16-bit unsigned or 32-bit int, image is BGR and the same size as labels - empty image = no mean color
+    // each thread sums a strip of rows, strips are merged at the end
+{
+    std::unordered_map<int, labelSums> sums; // all labels
+    std::mutex sumsMutex; // merge of the strips
+
+    bool color = (!image.empty()) && (image.type() == CV_8UC3) && (image.size() == labels.size()); // mean color wanted ?
+
+    parallel_for_(Range(0, labels.rows), [&](const Range &range) {
+        std::unordered_map<int, labelSums> local; // sums of this strip
+
+        for (int row = range.start; row < range.end; row++) {
+            const Vec3b* pixel = color ? image.ptr<Vec3b>(row) : NULL;
+            ScanLabelRow(labels, row, [&](const int &id, const int &colStart, const int &col) { // add each run to its label
+                int64 length = col - colStart;
+                std::unordered_map<int, labelSums>::iterator found = local.find(id);
+                if (found == local.end()) { // first run of this label in the strip
+                    labelSums s;
+                    s.pixels = 0; s.sumX = 0; s.sumY = 0;
+                    s.left = colStart; s.top = row; s.right = col - 1; s.bottom = row;
+                    s.sumColor[0] = 0; s.sumColor[1] = 0; s.sumColor[2] = 0;
+                    found = local.insert(std::make_pair(id, s)).first;
+                }
+                labelSums &s = found->second;
+                s.pixels += length;
+                s.sumX += (int64(colStart) + col - 1) * length / 2; // colStart + ... + col-1
+                s.sumY += int64(row) * length;
+                s.left = std::min(s.left, colStart);
+                s.right = std::max(s.right, col - 1);
+                s.bottom = row; // rows are scanned in order
+                if (color)
+                    for (int c = colStart; c < col; c++) {
+                        s.sumColor[0] += pixel[c][0];
+                        s.sumColor[1] += pixel[c][1];
+                        s.sumColor[2] += pixel[c][2];
                     }
-            return; // done ! -> exit
+            });
         }
-        case (gradient_doubleLinear): { // double linear = 2 times linear, just invert the vector the second time
-            int A = (endPoint.x - beginPoint.x); // same comments as linear
-            int B = (endPoint.y - beginPoint.y);
-            int C1 = A * beginPoint.x + B * beginPoint.y;
-            int C2 = A * endPoint.x + B * endPoint.y;
-
-            float CO;
-
-            for (int row = area.y; row < area.y + area.height; row++)
-                for (int col = area.x; col < area.x + area.width; col++)
-                    if (msk.at<uchar>(row, col) != 0) {
-                        int C = A * col + B * row;
-                        if (((C > C1) & (C < C2)) | (C >= C2) | (C == C1))  { // the only difference is we don't fill "before" the begin point
-                            if (C == C1) CO = beginColor;
-                                else if (C >= C2) CO = endColor;
-                                    else CO = round(GrayCurve(float(beginColor * (C2 - C) + endColor * (C - C1))/(C2 - C1),
-                                                        curve, beginColor, endColor - beginColor));
-                            img.at<uchar>(row, col) = CO;
-                        }
-                    }
 
-            Point newEndPoint; // invert the vector
-            newEndPoint.x = 2* beginPoint.x - endPoint.x;
-            newEndPoint.y = 2* beginPoint.y - endPoint.y;
-
-            A = (newEndPoint.x - beginPoint.x); // same as before, but with new inverted vector
-            B = (newEndPoint.y - beginPoint.y);
-            C1 = A * beginPoint.x + B * beginPoint.y;
-            C2 = A * newEndPoint.x + B * newEndPoint.y;
-
-            for (int row = area.y; row < area.y + area.height; row++)
-                for (int col = area.x; col < area.x + area.width; col++)
-                    if (msk.at<uchar>(row, col) != 0) {
-                        int C = A * col + B * row;
-                        if (((C > C1) & (C < C2)) | (C >= C2) | (C == C1)) { // once again don't fill "before" begin point
-                            if (C == C1) CO = beginColor;
-                                else if (C >= C2) CO = endColor;
-                                    else CO = round(GrayCurve(float(beginColor * (C2 - C) + endColor * (C - C1))/(C2 - C1),
-                                                        curve, beginColor, endColor - beginColor));
-                            img.at<uchar>(row, col) = CO;
-                        }
-                    }
-            return;
+        std::lock_guard<std::mutex> lock(sumsMutex); // add the strip to the total
+        for (std::unordered_map<int, labelSums>::const_iterator it = local.begin(); it != local.end(); ++it) {
+            std::unordered_map<int, labelSums>::iterator found = sums.find(it->first);
+            if (found == sums.end()) {
+                sums.insert(*it);
+                continue;
+            }
+            labelSums &s = found->second;
+            s.pixels += it->second.pixels;
+            s.sumX += it->second.sumX;
+            s.sumY += it->second.sumY;
+            s.left = std::min(s.left, it->second.left);
+            s.top = std::min(s.top, it->second.top);
+            s.right = std::max(s.right, it->second.right);
+            s.bottom = std::max(s.bottom, it->second.bottom);
+            for (int c = 0; c < 3; c++)
+                s.sumColor[c] += it->second.sumColor[c];
         }
-        case (gradient_radial): { // radial = concentric circles
-            float radius = std::sqrt(std::pow(beginPoint.x - endPoint.x, 2) + std::pow(beginPoint.y - endPoint.y, 2)); // maximum euclidian distance = vector length
+    });
+
+    labelStatsIndex stats; // sums -> statistics
+    stats.reserve(sums.size());
+    for (std::unordered_map<int, labelSums>::const_iterator it = sums.begin(); it != sums.end(); ++it) {
+        const labelSums &s = it->second;
+        labelStats &stat = stats[it->first];
+        stat.pixels = int(s.pixels);
+        stat.centroid = Point2d(double(s.sumX) / s.pixels, double(s.sumY) / s.pixels); // same values as moments m10/m00 and m01/m00
+        stat.bounds = Rect(s.left, s.top, s.right - s.left + 1, s.bottom - s.top + 1);
+        for (int c = 0; c < 3; c++)
+            stat.meanColor[c] = saturate_cast<uchar>(double(s.sumColor[c]) / s.pixels);
+    }
 
-            int CO; // will contain color values
+    return stats;
+}
 
-            for (int row = area.y; row < area.y + area.height; row++) // scan entire mask
-                for (int col = area.x; col < area.x + area.width; col++)
-                    if (msk.at<uchar>(row, col) != 0) { // non-zero pixel in mask
-                        CO = round(GrayCurve(beginColor + EuclideanDistance(beginPoint, Point(col, row), radius) / radius * (endColor - beginColor),
-                                             curve, beginColor, endColor - beginColor)); // pixel in temp gradient mask = distance percentage, "shaped" by gray curve
-                        img.at<uchar>(row, col) = CO;
-                    }
-            return;
-        }
+///////////////////////////////////////////////////////////
+//// Labels files
+///////////////////////////////////////////////////////////
+
+// labels binary file, all values are 32-bit little-endian :
+//   header : magic "LBLS", version, rows, cols
+//   then qCompress of the runs of the same label id, row after row - a run can go on to the next row : (id, length) pairs
+
+static const quint32 labelsFileMagic = 0x534C424C; // "LBLS" in file order
+static const quint32 labelsFileVersion = 1;
+static const int labelsFileHeaderSize = 4 * 4; // bytes
+
+QByteArray EncodeLabelsFile(const Mat &labels) // contents of a labels binary file, to be written as is
+{
+    std::vector<qint32> runs; // (id, length) pairs
+    int currentId = 0; // id of current run
+    qint32 length = 0; // length of current run, 0 = no run yet
+    for (int row = 0; row < labels.rows; row++)
+        ScanLabelRow(labels, row, [&](const int &id, const int &colStart, const int &colEnd) {
+            if ((length > 0) && (id == currentId)) // same label as the end of previous row
+                length += colEnd - colStart;
+            else {
+                if (length > 0) { // previous run is done
+                    runs.push_back(currentId);
+                    runs.push_back(length);
+                }
+                currentId = id;
+                length = colEnd - colStart;
+            }
+        });
+    if (length > 0) { // last run
+        runs.push_back(currentId);
+        runs.push_back(length);
+    }
+
+    for (size_t n = 0; n < runs.size(); n++) // same file on all processors
+        runs[n] = qToLittleEndian(runs[n]);
+    quint32 header[4] = {qToLittleEndian(labelsFileMagic), qToLittleEndian(labelsFileVersion),
+                         qToLittleEndian(quint32(labels.rows)), qToLittleEndian(quint32(labels.cols))};
+
+    QByteArray data(reinterpret_cast<const char*>(header), labelsFileHeaderSize);
+    data.append(qCompress(reinterpret_cast<const uchar*>(runs.data()), int(runs.size() * sizeof(qint32)))); // deflate
+
+    return data;
+}
+
+Mat LoadLabelsFile(const std::string &filename) // read labels from a compressed binary file - empty if something is wrong
+{
+    QFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::ReadOnly)) // no file
+        return Mat();
+    QByteArray data = file.readAll();
+    file.close();
+
+    if (data.size() < labelsFileHeaderSize) // not even a header
+        return Mat();
+    const uchar* header = reinterpret_cast<const uchar*>(data.constData());
+    quint32 magic = qFromLittleEndian<quint32>(header);
+    quint32 version = qFromLittleEndian<quint32>(header + 4);
+    int rows = int(qFromLittleEndian<quint32>(header + 8));
+    int cols = int(qFromLittleEndian<quint32>(header + 12));
+    if ((magic != labelsFileMagic) || (version != labelsFileVersion) || (rows <= 0) || (cols <= 0)) // not a labels file
+        return Mat();
+
+    QByteArray raw = qUncompress(reinterpret_cast<const uchar*>(data.constData()) + labelsFileHeaderSize, data.size() - labelsFileHeaderSize); // runs
+    data.clear();
+    if ((raw.isEmpty()) || (raw.size() % (2 * sizeof(qint32)) != 0)) // corrupted
+        return Mat();
+
+    const uchar* runs = reinterpret_cast<const uchar*>(raw.constData());
+    size_t count = raw.size() / (2 * sizeof(qint32)); // number of runs
+
+    int64 total = 0; // number of pixels
+    int minId = INT_MAX, maxId = INT_MIN; // range of ids, to choose the labels depth
+    for (size_t n = 0; n < count; n++) {
+        int id = qFromLittleEndian<qint32>(runs + 8 * n);
+        int length = qFromLittleEndian<qint32>(runs + 8 * n + 4);
+        if (length <= 0) // corrupted
+            return Mat();
+        total += length;
+        minId = std::min(minId, id);
+        maxId = std::max(maxId, id);
+    }
+    if (total != int64(rows) * cols) // runs don't cover the image
+        return Mat();
+
+    bool compact = (minId >= 0) && (maxId <= USHRT_MAX); // 16 bits are enough
+    Mat labels(rows, cols, compact ? CV_16UC1 : CV_32SC1); // new Mat = continuous, runs can be written across rows
+    int64 pixel = 0; // index of the first pixel of the run
+    for (size_t n = 0; n < count; n++) {
+        int id = qFromLittleEndian<qint32>(runs + 8 * n);
+        int length = qFromLittleEndian<qint32>(runs + 8 * n + 4);
+        if (compact)
+            std::fill_n(labels.ptr<ushort>() + pixel, length, ushort(id));
+        else
+            std::fill_n(labels.ptr<int>() + pixel, length, id);
+        pixel += length;
+    }
+
+    return labels;
+}
+
+// journal file, all values are 32-bit little-endian :
+//   header : magic "JRNL", version
+//   then one record per gradient edit, appended : label id, gradient type, curve, begin color, end color, begin point x y, end point x y
+
+static const quint32 journalMagic = 0x4C4E524A; // "JRNL" in file order
+static const quint32 journalVersion = 1;
+static const int journalHeaderSize = 2 * 4; // bytes
+static const int journalRecordSize = 9 * 4; // bytes
+
+QByteArray EncodeJournalHeader() // beginning of a journal file
+{
+    quint32 header[2] = {qToLittleEndian(journalMagic), qToLittleEndian(journalVersion)};
+
+    return QByteArray(reinterpret_cast<const char*>(header), journalHeaderSize);
+}
+
+QByteArray EncodeJournalRecord(const int &id, const grayGradient &gradient) // one gradient edit, to be appended to a journal file
+{
+    qint32 record[9] = {id, gradient.gradient, gradient.curve, gradient.beginColor, gradient.endColor,
+                        gradient.beginPoint.x, gradient.beginPoint.y, gradient.endPoint.x, gradient.endPoint.y};
+    for (int n = 0; n < 9; n++)
+        record[n] = qToLittleEndian(record[n]);
+
+    return QByteArray(reinterpret_cast<const char*>(record), journalRecordSize);
+}
+
+std::vector<journalRecord> DecodeJournal(const QByteArray &data) // all edits of a journal file, in order - empty if not a journal
+{
+    std::vector<journalRecord> records;
+
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    if ((data.size() < journalHeaderSize) || (qFromLittleEndian<quint32>(bytes) != journalMagic)
+            || (qFromLittleEndian<quint32>(bytes + 4) != journalVersion)) // not a journal
+        return records;
+
+    int count = (data.size() - journalHeaderSize) / journalRecordSize; // an incomplete last record (crash while writing) is ignored
+    records.reserve(count);
+    for (int n = 0; n < count; n++) {
+        const uchar* record = bytes + journalHeaderSize + n * journalRecordSize;
+        qint32 values[9];
+        for (int v = 0; v < 9; v++)
+            values[v] = qFromLittleEndian<qint32>(record + 4 * v);
+
+        if ((values[1] < gradient_flat) || (values[1] > gradient_radial) || (values[2] < curve_linear) || (values[2] > curve_undulate3)
+                || (values[3] < 0) || (values[3] > 255) || (values[4] < 0) || (values[4] > 255)) // garbage : unknown gradient or curve, or colors that are not gray levels
+            continue;
+
+        journalRecord edit;
+        edit.id = values[0];
+        edit.gradient.gradient = gradientType(values[1]);
+        edit.gradient.curve = curveType(values[2]);
+        edit.gradient.beginColor = values[3];
+        edit.gradient.endColor = values[4];
+        edit.gradient.beginPoint = Point(values[5], values[6]);
+        edit.gradient.endPoint = Point(values[7], values[8]);
+        records.push_back(edit);
     }
+
+    return records;
+}
+
+///////////////////////////////////////////////////////////
+//// Image files
+///////////////////////////////////////////////////////////
+
+bool ReadPNGSize(const std::string &filename, Size &size) // width and height of a PNG image from its header, without decoding it - false if not a PNG file
+{
+    QFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::ReadOnly)) // no file
+        return false;
+    QByteArray header = file.read(24); // signature (8 bytes) then the IHDR chunk : length (4), type (4), width (4), height (4)
+    file.close();
+
+    static const char signature[8] = {char(0x89), 'P', 'N', 'G', '\r', '\n', char(0x1A), '\n'};
+    if ((header.size() < 24) || (memcmp(header.constData(), signature, 8) != 0) || (memcmp(header.constData() + 12, "IHDR", 4) != 0)) // not a PNG file
+        return false;
+
+    const uchar* data = reinterpret_cast<const uchar*>(header.constData());
+    size = Size(int(qFromBigEndian<quint32>(data + 16)), int(qFromBigEndian<quint32>(data + 20))); // big-endian values
+
+    return true;
 }
 
 //// Color tints
@@ -13,6 +13,11 @@
  * Contours using Canny algorithm with auto min and max threshold
  * Noise reduction quality
  * Gray gradients
+ * Depthmap rebuild from all label gradients
+ * Label runs and statistics
+ * Labels binary files
+ * Gradient edits journal
+ * PNG image size from file header
  * Red-cyan anaglyph tints
  *
 #-------------------------------------------------*/
@@ -20,6 +25,9 @@
 #ifndef MAT2IMAGE_H
 #define MAT2IMAGE_H
 
+#include <unordered_map>
+#include <QByteArray>
+
 #include "opencv2/opencv.hpp"
 #include <opencv2/ximgproc.hpp>
 
@@ -30,6 +38,41 @@ enum curveType {curve_linear, curve_cosinus2, curve_sigmoid, curve_cosinus, curv
                 curve_power2, curve_cos2power2, curve_power3, curve_undulate, curve_undulate2, curve_undulate3}; // gray curve types
 enum anaglyphTint {tint_color, tint_gray, tint_true, tint_half, tint_optimized, tint_dubois}; // red/cyan anaglyph tints
 
+struct labelRun { // horizontal run of pixels of the same label
+    int row; // image row
+    int colStart, colEnd; // first column and column after the last one
+};
+typedef std::vector<labelRun> labelRuns; // all runs of one label, sorted by row
+typedef std::unordered_map<int, labelRuns> labelRunsIndex; // runs of all labels, by label id
+
+struct labelShape { // what is needed to show a label
+    cv::Rect bounds; // smallest rectangle containing the label
+    cv::Mat mask; // label mask, only the size of bounds
+    std::vector<std::vector<cv::Point>> contours; // external contours, in image coordinates
+};
+
+struct labelStats { // statistics of one label
+    int pixels; // number of pixels
+    cv::Point2d centroid; // barycenter of the pixels
+    cv::Rect bounds; // smallest rectangle containing the pixels
+    cv::Vec3b meanColor; // mean color of the pixels in the reference image, same channel order
+};
+typedef std::unordered_map<int, labelStats> labelStatsIndex; // statistics of all labels, by label id
+
+struct grayGradient { // gray gradient of a label
+    cv::Point beginPoint; // gradient vector
+    cv::Point endPoint;
+    int beginColor; // gray levels
+    int endColor;
+    gradientType gradient; // gradient type
+    curveType curve; // gray curve
+};
+
+struct journalRecord { // one gradient edit in a session journal
+    int id; // label id
+    grayGradient gradient; // new gradient of the label
+};
+
 bool IsRGBColorDark(int red, int green, int blue); // is the RGB value given dark or not ?
 
 cv::Mat QImage2Mat(const QImage &source); // convert QImage to Mat
@@ -57,10 +100,35 @@ cv::Mat DrawColoredContours(const cv::Mat &source, const double &sigma, const in
 
 double PSNR(const cv::Mat &source1, const cv::Mat &source2); // noise difference between 2 images
 
+cv::Mat GrayCurveTable(const int &curve, const int &beginColor, const int &endColor); // cached lookup table of a gray curve for the 256 gray levels
 void GradientFillGray(const int &gradient_type, cv::Mat &img, const cv::Mat &msk,
                       const cv::Point &beginPoint, const cv::Point &endPoint,
                       const int &beginColor, const int &endColor,
                       const int &curve, cv::Rect area = cv::Rect(0, 0, 0, 0)); // fill a 1-channel image with the mask converted to gray gradients
+void GradientFillGray(const int &gradient_type, cv::Mat &img, const labelRuns &runs,
+                      const cv::Point &beginPoint, const cv::Point &endPoint,
+                      const int &beginColor, const int &endColor,
+                      const int &curve); // fill the runs of a label in a 1-channel image with gray gradients
+void RebuildDepthmap(cv::Mat &depthmap, const cv::Mat &labels,
+                     const std::vector<int> &ids, const std::vector<grayGradient> &gradients); // fill all labels of depthmap with their gradients, in one pass
+
+// labels images are 1-channel CV_16UC1 when all ids fit, CV_32SC1 otherwise : all functions accept both
+cv::Mat CompactLabels(const cv::Mat &labels); // labels on 16 bits if all ids fit, else on 32 bits
+int LabelAt(const cv::Mat &labels, const int &row, const int &col); // label id of a pixel
+labelRunsIndex IndexLabelRuns(const cv::Mat &labels); // runs of pixels of all labels, in one pass
+cv::Rect LabelRunsBoundingRect(const labelRuns &runs); // smallest rectangle containing all runs of a label
+void LabelRunsMask(const labelRuns &runs, cv::Mat &mask, const cv::Point &origin = cv::Point(0, 0)); // draw runs in a 1-channel mask whose top-left is at origin
+labelShape LabelRunsShape(const labelRuns &runs); // bounding rect, cropped mask and contours of a label
+labelStatsIndex ComputeLabelStats(const cv::Mat &labels, const cv::Mat &image); // pixel count, centroid, bounding rect and mean color of all labels, in one pass
+
+QByteArray EncodeLabelsFile(const cv::Mat &labels); // contents of a labels compressed binary file, to be written as is
+cv::Mat LoadLabelsFile(const std::string &filename); // read labels from a compressed binary file - empty if something is wrong
+
+QByteArray EncodeJournalHeader(); // beginning of a journal file
+QByteArray EncodeJournalRecord(const int &id, const grayGradient &gradient); // one gradient edit, to be appended to a journal file
+std::vector<journalRecord> DecodeJournal(const QByteArray &data); // all edits of a journal file, in order - empty if not a journal
+
+bool ReadPNGSize(const std::string &filename, cv::Size &size); // width and height of a PNG image from its header, without decoding it - false if not a PNG file
 
 cv::Mat AnaglyphTint(const cv::Mat & source, const int &tint); // change tint of image to avoid disturbing colors in red-cyan anaglyph mode
 
@@ -6,7 +6,9 @@
 #
 #               v1.5 - 2019/07/08
 #
-# * .ply mesh export
+# * .ply mesh export : binary or ascii
+#
+# * Adaptive mesh : fewer triangles where the depthmap is flat or linear, depth error under a threshold
 #
 # * Render using openGL VBO (i.e. in GPU memory)
 #
@@ -33,6 +35,8 @@
 #include <QOpenGLBuffer>
 #include <QOpenGLTexture>
 #include <QtOpenGL>
+#include <QtEndian>
+#include <cfloat>
 
 #include "opencv2/opencv.hpp"
 #include "openglwidget.h"
@@ -87,6 +91,8 @@ void openGLWidget::initializeGL() // launched when the widget is initialized
     updateVertices3D = false; // not a partial update
     updateAllVertices3D = false; // used by updateVertices3D
     zoom3D = 8; // zoom coefficient
+    meshError3D = 0; // full resolution mesh
+    drawMode = GL_TRIANGLE_STRIP;
     axesEnabled = true; // draw 3D origin axes enabled
     anaglyphEnabled = false; // anaglypgh red / cyan rendering disabled
     anaglyphShift = -1.5; // shift of cyan vs red image (angle in degrees on y axis)
@@ -149,11 +155,6 @@ void openGLWidget::ComputeVertices()  // (re)create vertices array and buffer
 
 void openGLWidget::UpdateVertices() // update vertices z
 {
-    Rect area_save = area3D; // save values for later
-    if (updateAllVertices3D) { // ... precisely in case of this
-        area3D = Rect(0, 0, image3D.cols, image3D.rows); // area is the whole image
-    }
-
     vertexbuffer.bind(); // use current VBO
     GLfloat* posBuffer = (GLfloat*) (vertexbuffer.map(QOpenGLBuffer::WriteOnly)); // map a pointer on it
 
@@ -161,11 +162,25 @@ void openGLWidget::UpdateVertices() // update vertices z
 
         int index; // index of current vertex
 
-        for (int row = area3D.y; row < area3D.y + area3D.height; row++) { // for each row of area
-            for (int col = area3D.x; col < area3D.x + area3D.width; col++) { // for each pixel in the row from left to right
-                if ((updateAllVertices3D) | (mask3D.at<uchar>(row, col) != 0)) { // current pixel set in mask ?
+        if ((!updateAllVertices3D) && (!runs3D.empty())) { // only the runs of pixels of the label
+            for (size_t n = 0; n < runs3D.size(); n++) { // for each run
+                const uchar* depth = depthmap3D.ptr<uchar>(runs3D[n].row); // row of depthmap
+                for (int col = runs3D[n].colStart; col < runs3D[n].colEnd; col++) { // for each pixel in the run from left to right
+                    index = VertexIndex(runs3D[n].row, col); // use index of this pixel
+                    posBuffer[3 * index + 2] = (depth[col] - 127) * depth3D; // rewrite directly into VBO
+                }
+            }
+        }
+        else { // several labels or the whole image : a rectangle
+            cv::Rect area = cv::Rect(0, 0, depthmap3D.cols, depthmap3D.rows); // the whole image
+            if (!updateAllVertices3D) // or only the part that changed
+                area &= area3D;
+
+            for (int row = area.y; row < area.y + area.height; row++) { // for each row of the area
+                const uchar* depth = depthmap3D.ptr<uchar>(row); // row of depthmap
+                for (int col = area.x; col < area.x + area.width; col++) { // for each pixel in the row from left to right
                     index = VertexIndex(row, col); // use index of this pixel
-                    posBuffer[3 * index + 2] = (depthmap3D.at<uchar>(row, col) - 127) * depth3D; // rewrite directly into VBO
+                    posBuffer[3 * index + 2] = (depth[col] - 127) * depth3D; // rewrite directly into VBO
                 }
             }
         }
@@ -176,46 +191,233 @@ void openGLWidget::UpdateVertices() // update vertices z
     vertexbuffer.release(); // release VBO
 
     updateVertices3D = false; // done recomputing
-
-    if (updateAllVertices3D) { // restore old values
-        area3D = area_save;
-        updateAllVertices3D = false;
-    }
+    updateAllVertices3D = false;
 }
 
-void openGLWidget::ComputeIndexes() // (re)create index array and buffer
+template <typename F> static void ForEachStripIndex(const int &rowBegin, const int &rowEnd, const int &cols, F index) // indexes of the triangle strip covering an image, in order
+    // strip row "row" links image rows row and row+1 : an image of n rows has n-1 strip rows
 {
-    indexarray.clear(); // destroy buffers and arrays
-    indexbuffer.destroy();
-    int arraySize = NumberOfIndexes(image3D.rows, image3D.cols); // how many indexes ?
-    //indexarray.reserve(arraySize); // reserve memory space in advance
-
-    for (int row = 0; row < depthmap3D.rows -1; row++) { // for each row of the images
+    for (int row = rowBegin; row < rowEnd; row++) { // for each row of the images
         if (int(row)%2 == 0) { // row number is even
-            for (int col = 0; col < depthmap3D.cols; col++) { // for each pixel in the row from left to right
-                indexarray.push_back(VertexIndex(row, col)); // index in buffer
-                indexarray.push_back(VertexIndex(row+1, col));
+            for (int col = 0; col < cols; col++) { // for each pixel in the row from left to right
+                index(GLuint(row * cols + col)); // index in buffer
+                index(GLuint((row+1) * cols + col));
             }
         }
         else { // row number is odd
-            for (int col = depthmap3D.cols - 1; col > 0 ; col--) { // for each pixel in the row from right to left except the first one
-                indexarray.push_back(VertexIndex(row+1, col)); // the first time it creates a "degenerate triangle"
-                indexarray.push_back(VertexIndex(row, col-1));
+            for (int col = cols - 1; col > 0 ; col--) { // for each pixel in the row from right to left except the first one
+                index(GLuint((row+1) * cols + col)); // the first time it creates a "degenerate triangle"
+                index(GLuint(row * cols + col-1));
             }
             int col = 1;
-            indexarray.push_back(VertexIndex(row+1, col-1)); // add one more vertex to finish the column
+            index(GLuint((row+1) * cols + col-1)); // add one more vertex to finish the column
+        }
+    }
+}
+
+// adaptive mesh : each row of the depthmap is simplified to the fewest columns that keep the depth error under a threshold,
+// then two consecutive rows are zipped together with triangles - a flat or linear label needs two triangles per row instead of two per pixel
+
+static double SimplifyRow(const uchar* depth, const int &cols, const double &tolerance, std::vector<int> &kept) // greedy error-bounded simplification of a row : returns the biggest depth error achieved
+    // from each kept column, go as far as possible while the line to the end column stays within tolerance of all the depths in between
+{
+    kept.clear();
+    if (cols <= 0)
+        return 0;
+
+    kept.push_back(0);
+    double error = 0;
+    int anchor = 0; // last kept column
+    while (anchor < cols - 1) {
+        double low = -DBL_MAX, high = DBL_MAX; // slopes from the anchor that pass close enough to all the depths seen so far
+        int end = anchor + 1; // a segment of one pixel is always good
+        for (int col = anchor + 1; col < cols; col++) {
+            double distance = col - anchor;
+            double slope = double(depth[col] - depth[anchor]) / distance;
+            if ((slope >= low) && (slope <= high)) // this column can end the segment
+                end = col;
+            low = std::max(low, (depth[col] - depth[anchor] - tolerance) / distance); // next segments must pass close to this column
+            high = std::min(high, (depth[col] - depth[anchor] + tolerance) / distance);
+            if (low > high) // no segment can go further
+                break;
+        }
+
+        for (int col = anchor + 1; col < end; col++) // error really achieved by the segment
+            error = std::max(error, std::abs(depth[anchor] + double(depth[end] - depth[anchor]) * (col - anchor) / (end - anchor) - depth[col]));
+
+        kept.push_back(end);
+        anchor = end;
+    }
+
+    return error;
+}
+
+static inline int MeshStripTriangles(const meshRows &mesh, const int &row) // triangles zipping image rows row and row+1 of an adaptive mesh
+{
+    return int(mesh.columns[row].size() + mesh.columns[row + 1].size()) - 2; // each kept column except the first one of both rows adds a triangle
+}
+
+static void SimplifyMeshRows(meshRows &mesh, const Mat &depthmap, const double &tolerance, const int &rowBegin, const int &rowEnd) // simplify again some rows of an adaptive mesh, and update its totals
+{
+    cv::parallel_for_(cv::Range(rowBegin, rowEnd), [&](const cv::Range &range) { // rows are independent
+        for (int row = range.start; row < range.end; row++)
+            mesh.errors[row] = SimplifyRow(depthmap.ptr<uchar>(row), depthmap.cols, tolerance, mesh.columns[row]);
+    });
+
+    mesh.error = 0;
+    mesh.triangles = 0;
+    for (int row = 0; row < depthmap.rows; row++) {
+        mesh.error = std::max(mesh.error, mesh.errors[row]);
+        if (row < depthmap.rows - 1)
+            mesh.triangles += MeshStripTriangles(mesh, row);
+    }
+}
+
+static meshRows SimplifyMesh(const Mat &depthmap, const double &tolerance) // adaptive mesh of a depthmap - no simplification if tolerance <= 0
+{
+    meshRows mesh;
+    mesh.error = 0;
+    mesh.triangles = 2 * std::max(depthmap.rows - 1, 0) * std::max(depthmap.cols - 1, 0); // full resolution
+    if ((tolerance <= 0) || (depthmap.empty()))
+        return mesh;
+
+    mesh.columns.resize(depthmap.rows);
+    mesh.errors.resize(depthmap.rows);
+    SimplifyMeshRows(mesh, depthmap, tolerance, 0, depthmap.rows);
+
+    return mesh;
+}
+
+template <typename F> static void ForEachMeshTriangle(const meshRows &mesh, const int &rowBegin, const int &rowEnd, const int &cols, F triangle) // triangles list of some strip rows, in order : adaptive mesh, or two triangles per pixel if not simplified
+    // all triangles turn the same way as the first triangle of the strip, none has a zero area, and the rows share their kept columns : no cracks
+{
+    if (mesh.columns.empty()) { // full resolution : each square of 4 pixels is cut in two
+        for (int row = rowBegin; row < rowEnd; row++) {
+            GLuint topRow = GLuint(row * cols), bottomRow = GLuint((row + 1) * cols);
+            for (int col = 0; col < cols - 1; col++) {
+                triangle(topRow + col, bottomRow + col, topRow + col + 1);
+                triangle(topRow + col + 1, bottomRow + col, bottomRow + col + 1);
+            }
         }
+        return;
+    }
+
+    for (int row = rowBegin; row < rowEnd; row++) { // zip image rows row and row+1
+        const std::vector<int> &top = mesh.columns[row];
+        const std::vector<int> &bottom = mesh.columns[row + 1];
+        GLuint topRow = GLuint(row * cols), bottomRow = GLuint((row + 1) * cols);
+        size_t t = 0, b = 0; // current kept columns
+        while ((t + 1 < top.size()) || (b + 1 < bottom.size())) { // advance on the row whose next column is closest
+            if ((b + 1 == bottom.size()) || ((t + 1 < top.size()) && (top[t + 1] <= bottom[b + 1]))) {
+                triangle(topRow + top[t], bottomRow + bottom[b], topRow + top[t + 1]);
+                t++;
+            }
+            else {
+                triangle(topRow + top[t], bottomRow + bottom[b], bottomRow + bottom[b + 1]);
+                b++;
+            }
+        }
+    }
+}
+
+void openGLWidget::ComputeIndexes() // (re)create index array and buffer
+{
+    indexarray.clear(); // destroy buffers and arrays
+    indexbuffer.destroy();
+    meshRowStarts3D.clear();
+
+    mesh3D = SimplifyMesh(depthmap3D, meshError3D);
+    const meshRows &mesh = mesh3D;
+    if (mesh.columns.empty()) { // full resolution : one triangle strip
+        indexarray.reserve(NumberOfIndexes(image3D.rows, image3D.cols)); // reserve memory space in advance
+        ForEachStripIndex(0, depthmap3D.rows - 1, depthmap3D.cols, [this](const GLuint &index) {
+            indexarray.push_back(index);
+        });
+        drawMode = GL_TRIANGLE_STRIP;
+    }
+    else { // adaptive : triangles list
+        indexarray.reserve(3 * mesh.triangles);
+        ForEachMeshTriangle(mesh, 0, depthmap3D.rows - 1, depthmap3D.cols, [this](const GLuint &a, const GLuint &b, const GLuint &c) {
+            indexarray.push_back(a);
+            indexarray.push_back(b);
+            indexarray.push_back(c);
+        });
+        drawMode = GL_TRIANGLES;
+
+        meshRowStarts3D.resize(std::max(depthmap3D.rows, 1)); // where the triangles of each strip row begin, to patch them later
+        meshRowStarts3D[0] = 0;
+        for (int row = 0; row < depthmap3D.rows - 1; row++)
+            meshRowStarts3D[row + 1] = meshRowStarts3D[row] + 3 * MeshStripTriangles(mesh, row);
     }
 
     indexbuffer.create(); // create VBO vertices buffer
     indexbuffer.bind(); // bind it
-    indexbuffer.setUsagePattern(QOpenGLBuffer::StaticDraw); // vertex buffer will be often modified
+    indexbuffer.setUsagePattern(mesh.columns.empty() ? QOpenGLBuffer::StaticDraw : QOpenGLBuffer::DynamicDraw); // the adaptive mesh is patched when depths change
     indexbuffer.allocate(indexarray.constData(), indexarray.size()*sizeof(GLuint)); // allocate and populate in GPU RAM
     indexbuffer.release(); // done
 
     computeIndexes3D = false; // done recomputing
 
-    emit verticesChanged(arraySize); // emit signal for number of vertices
+    emit verticesChanged(indexarray.size()); // emit signal for number of vertices
+    emit meshChanged(mesh.triangles, mesh.error); // and for the mesh quality
+}
+
+void openGLWidget::UpdateIndexes(const int &rowBegin, const int &rowEnd) // adaptive mesh : simplify again image rows [rowBegin, rowEnd) and patch their triangles
+    // only the strip rows touching these image rows are rewritten in the index buffer : the rest of the mesh stays where it is, or is moved if the number of triangles changed
+{
+    if ((mesh3D.columns.empty()) || (int(mesh3D.columns.size()) != depthmap3D.rows)) { // no adaptive mesh of this depthmap yet
+        ComputeIndexes();
+        return;
+    }
+
+    int cols = depthmap3D.cols;
+    int first = std::max(rowBegin, 0), last = std::min(rowEnd, depthmap3D.rows); // image rows to simplify again
+    if (first >= last) // nothing changed
+        return;
+    SimplifyMeshRows(mesh3D, depthmap3D, meshError3D, first, last);
+
+    int stripBegin = std::max(first - 1, 0), stripEnd = std::min(last, depthmap3D.rows - 1); // strip rows using these image rows
+    if (stripBegin < stripEnd) {
+        QVector<GLuint> patch; // new triangles of these strip rows
+        patch.reserve(meshRowStarts3D[stripEnd] - meshRowStarts3D[stripBegin]);
+        ForEachMeshTriangle(mesh3D, stripBegin, stripEnd, cols, [&patch](const GLuint &a, const GLuint &b, const GLuint &c) {
+            patch.push_back(a);
+            patch.push_back(b);
+            patch.push_back(c);
+        });
+
+        int patchBegin = meshRowStarts3D[stripBegin], patchEnd = meshRowStarts3D[stripEnd]; // old triangles of these strip rows
+        int shift = patch.size() - (patchEnd - patchBegin);
+        int tail = indexarray.size() - patchEnd; // indexes after the patch
+        if (shift > 0) { // more triangles : make room
+            indexarray.resize(indexarray.size() + shift);
+            memmove(indexarray.data() + patchEnd + shift, indexarray.constData() + patchEnd, tail * sizeof(GLuint));
+        }
+        else if (shift < 0) { // fewer triangles
+            memmove(indexarray.data() + patchEnd + shift, indexarray.constData() + patchEnd, tail * sizeof(GLuint));
+            indexarray.resize(indexarray.size() + shift);
+        }
+        memcpy(indexarray.data() + patchBegin, patch.constData(), patch.size() * sizeof(GLuint));
+
+        for (int row = stripBegin; row < stripEnd; row++) // new starts of the patched strip rows...
+            meshRowStarts3D[row + 1] = meshRowStarts3D[row] + 3 * MeshStripTriangles(mesh3D, row);
+        for (size_t row = stripEnd + 1; row < meshRowStarts3D.size(); row++) // ... and of the moved ones
+            meshRowStarts3D[row] += shift;
+
+        int uploadEnd = (shift == 0) ? patchBegin + patch.size() : indexarray.size(); // indexes that changed in GPU RAM
+        indexbuffer.bind();
+        if (int(indexarray.size() * sizeof(GLuint)) > indexbuffer.size()) { // no room left : new buffer, with some room to grow
+            indexbuffer.allocate(int((indexarray.size() + indexarray.size() / 4) * sizeof(GLuint)));
+            patchBegin = 0;
+            uploadEnd = indexarray.size();
+        }
+        if (uploadEnd > patchBegin)
+            indexbuffer.write(patchBegin * sizeof(GLuint), indexarray.constData() + patchBegin, (uploadEnd - patchBegin) * sizeof(GLuint));
+        indexbuffer.release();
+    }
+
+    emit verticesChanged(indexarray.size()); // emit signal for number of vertices
+    emit meshChanged(mesh3D.triangles, mesh3D.error); // and for the mesh quality
 }
 
 void openGLWidget::ComputeColors() // (re)create colors array and buffer
@@ -240,106 +442,277 @@ void openGLWidget::ComputeColors() // (re)create colors array and buffer
     colorbuffer.release(); // release VBO
 }
 
-void openGLWidget::SaveToObj(const QString &filename) // Save current 3D arrays to WaveFront .obj file
+// ascii exports : the image is cut in blocks of rows, formatted in parallel and written in order
+// numbers are formatted without locales or streams : integers by hand, and depths and colors (256 values each) with a table made by the usual formatter
+
+static inline void TextPutInt(std::string &text, const long long &value) // integer in decimal, like std::to_string
+{
+    char digits[24];
+    int count = 0;
+    unsigned long long v = (value < 0) ? 0ULL - (unsigned long long)(value) : (unsigned long long)(value);
+    do {
+        digits[count++] = char('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+
+    if (value < 0)
+        text += '-';
+    while (count > 0)
+        text += digits[--count];
+}
+
+static std::string TextStreamNumber(const float &value) // a float formatted like QTextStream does it
+{
+    QString number;
+    QTextStream stream(&number);
+    stream << value;
+    stream.flush();
+
+    return number.toStdString();
+}
+
+template <typename F> static bool WriteTextBlocks(QFile &file, const int &rows, const int &cols, F format) // format blocks of rows in parallel and write them in order
+    // format(text, rowBegin, rowEnd) appends the text of rows [rowBegin, rowEnd) to text
+{
+    int blockRows = std::max(1, 16384 / std::max(cols, 1)); // about 16k vertices per block
+    int blocks = (rows + blockRows - 1) / blockRows;
+    int batch = std::max(1, cv::getNumThreads()) * 4; // blocks in memory at the same time : enough to keep all threads busy
+    std::vector<std::string> texts(batch);
+
+    for (int first = 0; first < blocks; first += batch) {
+        int count = std::min(batch, blocks - first);
+        cv::parallel_for_(cv::Range(0, count), [&](const cv::Range &range) {
+            for (int block = range.start; block < range.end; block++) {
+                int rowBegin = (first + block) * blockRows;
+                texts[block].clear();
+                format(texts[block], rowBegin, std::min(rowBegin + blockRows, rows));
+            }
+        });
+
+        for (int block = 0; block < count; block++) // in order
+            if (file.write(texts[block].data(), qint64(texts[block].size())) != qint64(texts[block].size()))
+                return false;
+    }
+
+    return true;
+}
+
+void openGLWidget::SaveToObj(const QString &filename) // Save depthmap and image to WaveFront .obj file, computed row by row : the 3D view doesn't need to be rendered
 {
     //open ascii text file for writing
     QFile file(filename);
-    if (file.open(QIODevice::ReadWrite))
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
     {
-        QTextStream stream(&file);
-        //stream << "example " << 49 << "\n";
-        //file.close();
-
-        // save vertices
-        QVector3D vertex, color;
-        int max = NumberOfVertices(image3D.rows, image3D.cols);
-
-        for (int index = 0; index < max; index++) {
-            vertex = vertexarray[index];
-            color = colorarray[index];
-            stream << "v " << vertex.x() << " " << vertex.y() << " " << vertex.z()
-                   << " " << color[0] << " " << color[1] << " " << color[2]
-                   << "\n";
+        std::string depths[256], colors[256]; // all possible depths and colors, as text
+        for (int n = 0; n < 256; n++) {
+            depths[n] = TextStreamNumber(float((n - 127) * depth3D));
+            colors[n] = TextStreamNumber(float(n / 255.0));
         }
 
-        // save indexes
-        max = NumberOfIndexes(image3D.rows, image3D.cols) - 2;
+        // save vertices, centered like the 3D view
+        int halfX = -depthmap3D.cols / 2; // to center the axes in middle of image
+        int halfY = depthmap3D.rows / 2;
+        auto coordinate = [](std::string &text, const int &value) { // integer as a float : big values are written in scientific notation
+            if (std::abs(value) < 1000000)
+                TextPutInt(text, value);
+            else
+                text += TextStreamNumber(float(value));
+        };
+
+        bool written = WriteTextBlocks(file, depthmap3D.rows, depthmap3D.cols, [&](std::string &text, const int &rowBegin, const int &rowEnd) {
+            for (int row = rowBegin; row < rowEnd; row++) { // for each row of the image
+                const uchar* depth = depthmap3D.ptr<uchar>(row);
+                const Vec3b* pixel = image3D.ptr<Vec3b>(row);
+                for (int col = 0; col < depthmap3D.cols; col++) { // for each pixel in the row from left to right
+                    text += "v ";
+                    coordinate(text, col + halfX);
+                    text += ' ';
+                    coordinate(text, -row + halfY);
+                    text += ' ';
+                    text += depths[depth[col]];
+                    text += ' ';
+                    text += colors[pixel[col][2]]; // RGB
+                    text += ' ';
+                    text += colors[pixel[col][1]];
+                    text += ' ';
+                    text += colors[pixel[col][0]];
+                    text += '\n';
+                }
+            }
+        });
 
-        for (int index = 0; index < max; index++) {
-            stream << "f " << indexarray[index]+1 << " " << indexarray[index+1]+1 << " " << indexarray[index+2]+1 << "\n";
-        }
+        // save indexes
+        meshRows mesh = SimplifyMesh(depthmap3D, meshError3D); // same mesh as the 3D view
+        if (written)
+            WriteTextBlocks(file, depthmap3D.rows - 1, depthmap3D.cols, [&](std::string &text, const int &rowBegin, const int &rowEnd) {
+                ForEachMeshTriangle(mesh, rowBegin, rowEnd, depthmap3D.cols, [&text](const GLuint &a, const GLuint &b, const GLuint &c) {
+                    text += "f ";
+                    TextPutInt(text, a+1);
+                    text += ' ';
+                    TextPutInt(text, b+1);
+                    text += ' ';
+                    TextPutInt(text, c+1);
+                    text += '\n';
+                });
+            });
 
         file.close();
     }
 }
 
-void openGLWidget::SaveToPly(const QString &filename) // Save current 3D arrays to Polygon File Format .ply file
+static inline void PlyPutFloat(char* &dest, const float &value) // little-endian float in a binary PLY record
 {
-    //open ascii text file for writing
-    QFile file(filename);
-    if (file.open(QIODevice::ReadWrite))
-    {
-        QTextStream stream(&file);
-        //stream << "example " << 49 << "\n";
-        //file.close();
-
-        //// header
-        stream << "ply" << "\n";
-        stream << "format ascii 1.0" << "\n";
-        stream << "comment Produced by a tool from AbsurdePhoton" << "\n";
-        stream << "comment GitHub: https://github.com/AbsurdePhoton" << "\n";
-        stream << "comment My photography site: absurdephoton.fr" << "\n";
-
-        // quantities
-          // vertices
-        int maxVertices = NumberOfVertices(image3D.rows, image3D.cols);
-        stream << "element vertex " << maxVertices << "\n";
-        stream << "property float x" << "\n"; // define vertex x y and z
-        stream << "property float y" << "\n";
-        stream << "property float z" << "\n";
-        stream << "property uchar red" << "\n"; // and vertex colors
-        stream << "property uchar green" << "\n";
-        stream << "property uchar blue" << "\n";
-
-          // triangles
-        int maxTriangles = NumberOfIndexes(image3D.rows, image3D.cols) - 2;
-        stream << "element face " << maxTriangles << "\n";
-        stream << "property list uchar int vertex_index" << "\n";
-
-          // end of header
-        stream << "end_header" << "\n";
+    quint32 bits;
+    memcpy(&bits, &value, 4);
+    qToLittleEndian(bits, dest);
+    dest += 4;
+}
 
-        //// save vertices
-        QVector3D vertex, color;
+static inline void PlyPutInt(char* &dest, const qint32 &value) // little-endian int in a binary PLY record
+{
+    qToLittleEndian(value, dest);
+    dest += 4;
+}
 
-        int index; // index of current vertex
-        std::string st; // used to get a comma separator for floats, streams use locales !
+bool openGLWidget::SaveToPly(const QString &filename, const bool &binary) // Save depthmap and image to Polygon File Format .ply file - binary (compact and fast) or ascii
+    // vertices, colors and faces are computed row by row from depthmap3D and image3D : the 3D view doesn't need to be rendered, and memory use doesn't depend on image size
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) // replace previous file
+        return false;
+
+    int maxVertices = NumberOfVertices(image3D.rows, image3D.cols);
+    meshRows mesh = SimplifyMesh(depthmap3D, meshError3D); // same mesh as the 3D view
+    int maxTriangles = mesh.triangles; // triangles list : no degenerate triangles of the strip
+
+    //// header
+    QByteArray header;
+    header += "ply\n";
+    header += binary ? "format binary_little_endian 1.0\n" : "format ascii 1.0\n";
+    header += "comment Produced by a tool from AbsurdePhoton\n";
+    header += "comment GitHub: https://github.com/AbsurdePhoton\n";
+    header += "comment My photography site: absurdephoton.fr\n";
+
+    // quantities
+      // vertices
+    header += "element vertex " + QByteArray::number(maxVertices) + "\n";
+    header += "property float x\n"; // define vertex x y and z
+    header += "property float y\n";
+    header += "property float z\n";
+    header += "property uchar red\n"; // and vertex colors
+    header += "property uchar green\n";
+    header += "property uchar blue\n";
+
+      // triangles
+    header += "element face " + QByteArray::number(maxTriangles) + "\n";
+    header += "property list uchar int vertex_index\n";
+
+      // end of header
+    header += "end_header\n";
+
+    if (file.write(header) != header.size())
+        return false;
+
+    if (binary) {
+        // records are packed in a big buffer, written when full : few system calls
+        const int vertexSize = 3 * 4 + 3; // float x y z, uchar r g b
+        const int faceSize = 1 + 3 * 4; // uchar count, int indexes
+        const int bufferSize = 4 * 1024 * 1024; // bytes
+        std::vector<char> buffer(bufferSize);
+        char* end = buffer.data() + bufferSize - std::max(vertexSize, faceSize); // no room for another record after this
+        char* dest = buffer.data();
 
+        //// save vertices
         for (int row = 0; row < image3D.rows; row++) { // for each row of area
+            const uchar* depth = depthmap3D.ptr<uchar>(row);
+            const Vec3b* pixel = image3D.ptr<Vec3b>(row);
             for (int col = 0; col < image3D.cols; col++) { // for each pixel in the row from left to right
-                    index = VertexIndex(row, col); // use index of this pixel
-                    color = colorarray[index];
-                    /*stream << col << " " << -row << " " << qSetRealNumberPrecision(5) << (depthmap3D.at<uchar>(row, col) - 127) * depth3D
-                           << " " << int(round(color[0]*255)) << " " << int(round(color[1]*255)) << " " << int(round(color[2]*255))
-                           << "\n";*/
-                    st = std::to_string(col) + " " + std::to_string(-row) + " " + std::to_string(float((depthmap3D.at<uchar>(row, col) - 127) * depth3D))
-                            + " " + std::to_string(int(round(color[0]*255))) + " " + std::to_string(int(round(color[1]*255))) + " " + std::to_string(int(round(color[2]*255)))
-                            + "\n";
-                    stream << QString::fromStdString(st);
+                PlyPutFloat(dest, float(col));
+                PlyPutFloat(dest, float(-row));
+                PlyPutFloat(dest, float((depth[col] - 127) * depth3D));
+                *dest++ = char(pixel[col][2]); // RGB
+                *dest++ = char(pixel[col][1]);
+                *dest++ = char(pixel[col][0]);
+
+                if (dest > end) { // buffer full
+                    if (file.write(buffer.data(), dest - buffer.data()) != dest - buffer.data())
+                        return false;
+                    dest = buffer.data();
+                }
             }
         }
 
-        // save faces + indexes
-        int maxIndexes = NumberOfIndexes(image3D.rows, image3D.cols) - 2;
-
-        for (int index = 0; index < maxIndexes; index++) {
-            stream << "3 " << indexarray[index] << " " << indexarray[index+1] << " " << indexarray[index+2] << "\n";
-        }
+        //// save faces + indexes
+        bool written = true;
+        ForEachMeshTriangle(mesh, 0, image3D.rows - 1, image3D.cols, [&](const GLuint &a, const GLuint &b, const GLuint &c) {
+            *dest++ = 3; // triangles
+            PlyPutInt(dest, qint32(a));
+            PlyPutInt(dest, qint32(b));
+            PlyPutInt(dest, qint32(c));
+
+            if (dest > end) { // buffer full
+                written &= (file.write(buffer.data(), dest - buffer.data()) == dest - buffer.data());
+                dest = buffer.data();
+            }
+        });
+        if (!written)
+            return false;
 
-        // Close the file
-        stream << "\n";
+        if (file.write(buffer.data(), dest - buffer.data()) != dest - buffer.data()) // what's left
+            return false;
         file.close();
+
+        return (file.error() == QFileDevice::NoError);
+    }
+
+    //// ascii
+    std::string depths[256], colors[256]; // all possible depths and colors, as text
+    for (int n = 0; n < 256; n++) {
+        depths[n] = std::to_string(float((n - 127) * depth3D)); // 6 decimals, always a dot
+        colors[n] = std::to_string(n);
     }
+
+    //// save vertices
+    bool written = WriteTextBlocks(file, image3D.rows, image3D.cols, [&](std::string &text, const int &rowBegin, const int &rowEnd) {
+        for (int row = rowBegin; row < rowEnd; row++) { // for each row of area
+            const uchar* depth = depthmap3D.ptr<uchar>(row);
+            const Vec3b* pixel = image3D.ptr<Vec3b>(row);
+            for (int col = 0; col < image3D.cols; col++) { // for each pixel in the row from left to right
+                TextPutInt(text, col);
+                text += ' ';
+                TextPutInt(text, -row);
+                text += ' ';
+                text += depths[depth[col]];
+                text += ' ';
+                text += colors[pixel[col][2]]; // RGB
+                text += ' ';
+                text += colors[pixel[col][1]];
+                text += ' ';
+                text += colors[pixel[col][0]];
+                text += '\n';
+            }
+        }
+    });
+
+    // save faces + indexes
+    written = written && WriteTextBlocks(file, image3D.rows - 1, image3D.cols, [&](std::string &text, const int &rowBegin, const int &rowEnd) {
+        ForEachMeshTriangle(mesh, rowBegin, rowEnd, image3D.cols, [&text](const GLuint &a, const GLuint &b, const GLuint &c) {
+            text += "3 ";
+            TextPutInt(text, a);
+            text += ' ';
+            TextPutInt(text, b);
+            text += ' ';
+            TextPutInt(text, c);
+            text += '\n';
+        });
+    });
+
+    // Close the file
+    if ((!written) || (file.write("\n", 1) != 1))
+        return false;
+    file.close();
+
+    return (file.error() == QFileDevice::NoError);
 }
 
 void openGLWidget::paintGL() // 3D rendering
@@ -431,10 +804,21 @@ void openGLWidget::paintGL() // 3D rendering
     if (computeVertices3D) { // totally recompute vertices
         ComputeVertices();
         updateVertices3D = false;
+        if (meshError3D > 0) // the adaptive mesh follows the depths
+            computeIndexes3D = true;
     }
 
-    if (updateVertices3D) // partially recompute vertices
+    if (updateVertices3D) { // partially recompute vertices
+        bool all = updateAllVertices3D; // reset by UpdateVertices
+        Rect area = area3D;
         UpdateVertices();
+        if ((meshError3D > 0) && (!computeIndexes3D)) { // the adaptive mesh follows the depths
+            if (all) // the whole depthmap may have changed
+                computeIndexes3D = true;
+            else // only the rows that changed
+                UpdateIndexes(area.y, area.y + area.height);
+        }
+    }
 
     if (computeIndexes3D) { // totally recompute vertices
         ComputeIndexes();
@@ -457,7 +841,7 @@ void openGLWidget::paintGL() // 3D rendering
             glVertexPointer(3, GL_FLOAT, 0, NULL);
         vertexbuffer.release();
         indexbuffer.bind(); // the same for indexes
-            glDrawElements(GL_TRIANGLE_STRIP, indexarray.size(), GL_UNSIGNED_INT, NULL); // draw triangles
+            glDrawElements(drawMode, indexarray.size(), GL_UNSIGNED_INT, NULL); // draw triangles
         indexbuffer.release();
     glDisableClientState(GL_VERTEX_ARRAY); // finished defining vertices and colors
     glDisableClientState(GL_COLOR_ARRAY);
@@ -479,7 +863,7 @@ void openGLWidget::paintGL() // 3D rendering
             glVertexPointer(3, GL_FLOAT, 0, NULL);
         vertexbuffer.release();
         indexbuffer.bind();
-            glDrawElements(GL_TRIANGLE_STRIP, indexarray.size(), GL_UNSIGNED_INT, NULL);
+            glDrawElements(drawMode, indexarray.size(), GL_UNSIGNED_INT, NULL);
         indexbuffer.release();
         glDisableClientState(GL_VERTEX_ARRAY);
         glDisableClientState(GL_COLOR_ARRAY);
@@ -6,7 +6,9 @@
 #
 #               v1.5 - 2019/07/08
 #
-# * .ply mesh export
+# * .ply mesh export : binary or ascii
+#
+# * Adaptive mesh : fewer triangles where the depthmap is flat or linear, depth error under a threshold
 #
 # * Render using openGL VBO (i.e. in GPU memory)
 #
@@ -36,6 +38,15 @@
 #include <QOpenGLTexture>
 #include "opencv2/opencv.hpp"
 
+#include "mat-image-tools.h"
+
+struct meshRows { // simplified rows of an adaptive mesh
+    std::vector<std::vector<int>> columns; // kept columns of each row, first and last always kept - empty = full resolution strip
+    std::vector<double> errors; // biggest depth error of each row, in gray levels
+    double error; // biggest depth error of the mesh, in gray levels
+    int triangles; // number of triangles
+};
+
 class openGLWidget : public QOpenGLWidget
 {
     Q_OBJECT
@@ -50,7 +61,7 @@ public:
     bool computeVertices3D, // recompute all vertices and create a new buffer
          computeIndexes3D, // recompute all indexes and create a new buffer
          computeColors3D, // recompute all colors and create a new buffer
-         updateVertices3D, // recompute only vertices using the mask "mask3D", directly in GPU's RAM
+         updateVertices3D, // recompute only vertices using the runs "runs3D", or in the rectangle "area3D" if there are none, directly in GPU's RAM
          updateAllVertices3D; // when only updating vertices, indicate that the whole image is concerned
 
     QOpenGLBuffer vertexbuffer; // VBO for vertices
@@ -67,11 +78,12 @@ public:
 
     cv::Mat image3D; // reference image
     cv::Mat depthmap3D; // depthmap image
-    cv::Mat mask3D; // mask for partial update
-    cv::Rect area3D; // used for partial update
+    cv::Rect area3D; // used for partial update : the part of depthmap3D that changed
+    labelRuns runs3D; // used for partial update when only one label changed : its runs of pixels, inside area3D
 
     double zoom3D; // zoom coefficient
     double depth3D; // used for depthmap rendering
+    double meshError3D; // adaptive mesh : biggest depth error allowed in gray levels, 0 = full resolution triangle strip
 
     bool anaglyphEnabled; // anaglypgh red / cyan rendering (angle in degrees on y axis)
     double anaglyphShift; // shift of cyan vs red image
@@ -92,6 +104,7 @@ protected:
     void wheelEvent(QWheelEvent *event); // zoom
     void ComputeVertices(); // create vertices
     void ComputeIndexes(); // create indexes
+    void UpdateIndexes(const int &rowBegin, const int &rowEnd); // adaptive mesh : simplify again some image rows and patch their triangles
     void UpdateVertices(); // update vertices z
     void ComputeColors(); // recompute colors
     int NumberOfVertices(const int &rows, const int &cols); // number of expected vertices for an image
@@ -116,7 +129,7 @@ public slots:
     void SetShiftRight();
 
     void SaveToObj(const QString &filename);
-    void SaveToPly(const QString &filename);
+    bool SaveToPly(const QString &filename, const bool &binary = true); // binary little-endian or ascii - false if the file could not be written
 
 
 signals:
@@ -131,11 +144,15 @@ signals:
     void zoomChanged(double zoom); // zoom signal
 
     void verticesChanged(int nb_Vertices); // number of vertices signal
+    void meshChanged(int triangles, double error); // number of triangles and biggest depth error (gray levels) of the mesh
 
 
 private:
 
     QPoint lastPos; // save mouse position
+    GLenum drawMode; // GL_TRIANGLE_STRIP for the full mesh, GL_TRIANGLES for the adaptive one
+    meshRows mesh3D; // adaptive mesh shown in the 3D view
+    std::vector<int> meshRowStarts3D; // adaptive mesh : first index of each strip row in indexarray, and the end
 
 };
 
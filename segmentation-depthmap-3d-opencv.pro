@@ -8,7 +8,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui opengl
+QT       += core gui opengl concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -22,11 +22,13 @@ LIBS += -L/usr/local/lib -lopencv_core -lopencv_imgcodecs -lopencv_highgui
 SOURCES +=  main.cpp\
             mainwindow.cpp \
             mat-image-tools.cpp \
-            openglwidget.cpp
+            openglwidget.cpp \
+            labelsmodel.cpp
 
 HEADERS  += mainwindow.h \
             mat-image-tools.h \
-            openglwidget.h
+            openglwidget.h \
+            labelsmodel.h
 
 FORMS    += mainwindow.ui
 
@@ -0,0 +1,118 @@
+/*#-------------------------------------------------
+#
+#     Double linear gradients : single pass check
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * GradientFillGray fills double linear gradients in one pass
+#
+# * Compared with the old two-pass code on random masks, vectors, colors and curves :
+#     - masked fill, whole image or an area of it
+#     - label runs fill
+#
+# * Returns 0 if all pixels are the same, 1 otherwise
+#
+#-------------------------------------------------*/
+
+#include <QPixmap>
+#include <iostream>
+
+#include "opencv2/opencv.hpp"
+
+#include "mat-image-tools.h"
+#include "../gradient-reference.h"
+
+using namespace cv;
+
+static Mat RandomMask(RNG &rng, const int &rows, const int &cols) // random label shape
+{
+    Mat mask = Mat::zeros(rows, cols, CV_8UC1);
+    switch (rng.uniform(0, 4)) {
+        case 0: { // noise
+            randu(mask, Scalar(0), Scalar(2));
+            mask *= 255; // same label id as the other shapes
+            break;
+        }
+        case 1: { // blobs
+            int blobs = rng.uniform(1, 8);
+            for (int n = 0; n < blobs; n++)
+                circle(mask, Point(rng.uniform(0, cols), rng.uniform(0, rows)), rng.uniform(1, std::max(rows, cols)), Scalar(255), -1);
+            break;
+        }
+        case 2: { // thin diagonal
+            line(mask, Point(rng.uniform(0, cols), 0), Point(rng.uniform(0, cols), rows - 1), Scalar(255), rng.uniform(1, 6));
+            break;
+        }
+        default: // whole image
+            mask.setTo(255);
+    }
+
+    return mask;
+}
+
+static Point RandomPoint(RNG &rng, const int &rows, const int &cols) // gradient points can be outside the image
+{
+    return Point(rng.uniform(-cols, 2 * cols), rng.uniform(-rows, 2 * rows));
+}
+
+int main(int argc, char *argv[])
+{
+    int trials = (argc > 1) ? atoi(argv[1]) : 2000; // number of random gradients
+    RNG rng(20190708);
+    int failures = 0;
+
+    for (int trial = 0; trial < trials; trial++) {
+        int rows = rng.uniform(1, 300);
+        int cols = rng.uniform(1, 300); // wide enough rows for the vector path too
+        Mat mask = RandomMask(rng, rows, cols);
+
+        Point beginPoint = RandomPoint(rng, rows, cols);
+        Point endPoint = (rng.uniform(0, 20) == 0) ? beginPoint : RandomPoint(rng, rows, cols); // sometimes a null vector
+        int beginColor = rng.uniform(0, 256);
+        int endColor = rng.uniform(0, 256);
+        int curve = rng.uniform(int(curve_linear), int(curve_undulate3) + 1);
+
+        Rect area(0, 0, 0, 0); // whole image
+        if (rng.uniform(0, 2) == 0) { // or a part of it
+            area.x = rng.uniform(0, cols);
+            area.y = rng.uniform(0, rows);
+            area.width = rng.uniform(1, cols - area.x + 1);
+            area.height = rng.uniform(1, rows - area.y + 1);
+        }
+
+        Mat background(rows, cols, CV_8UC1); // pixels outside the mask must not change
+        randu(background, Scalar(0), Scalar(256));
+
+        Mat reference = background.clone();
+        ReferenceGradientFillGray(gradient_doubleLinear, reference, mask, beginPoint, endPoint, beginColor, endColor, curve, area);
+
+        Mat single = background.clone();
+        GradientFillGray(gradient_doubleLinear, single, mask, beginPoint, endPoint, beginColor, endColor, curve, area);
+
+        int different = countNonZero(reference != single);
+
+        // label runs : the whole mask
+        Mat labels;
+        mask.convertTo(labels, CV_32S);
+        labelRunsIndex runs = IndexLabelRuns(labels);
+        Mat referenceRuns = background.clone();
+        ReferenceGradientFillGray(gradient_doubleLinear, referenceRuns, mask, beginPoint, endPoint, beginColor, endColor, curve);
+        Mat singleRuns = background.clone();
+        labelRunsIndex::const_iterator found = runs.find(255);
+        if (found != runs.end())
+            GradientFillGray(gradient_doubleLinear, singleRuns, found->second, beginPoint, endPoint, beginColor, endColor, curve);
+
+        different += countNonZero(referenceRuns != singleRuns);
+
+        if (different > 0) {
+            failures++;
+            std::cout << "trial " << trial << " : " << different << " different pixels - size " << cols << "x" << rows
+                      << " vector " << beginPoint << " -> " << endPoint << " colors " << beginColor << " -> " << endColor
+                      << " curve " << curve << std::endl;
+        }
+    }
+
+    std::cout << trials - failures << " / " << trials << " double linear gradients identical to the two-pass code" << std::endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+#        Gray gradients : timing of all kernels
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = gradient-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES +=  main.cpp \
+            ../../mat-image-tools.cpp
+
+HEADERS  += ../../mat-image-tools.h \
+            ../gradient-reference.h
+
+# we add the package opencv to pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv4
+
+QMAKE_CXXFLAGS += -std=c++11
@@ -0,0 +1,106 @@
+/*#-------------------------------------------------
+#
+#        Gray gradients : timing of all kernels
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * Times GradientFillGray for the 4 gradient types x 11 gray curves :
+#     - "old"  : the per-pixel code it replaced (tests/gradient-reference.h)
+#     - "mask" : GradientFillGray with a mask
+#     - "runs" : GradientFillGray with the label runs, as the depthmap uses it
+#
+# * Usage : gradient-bench [width] [height] [threads] [repeats]
+#     - default 1920 x 1080, 1 thread, best of 5 runs
+#
+#-------------------------------------------------*/
+
+#include <QPixmap>
+#include <iostream>
+#include <iomanip>
+
+#include "opencv2/opencv.hpp"
+
+#include "mat-image-tools.h"
+#include "../gradient-reference.h"
+
+using namespace cv;
+
+static const char* gradientNames[] = {"flat", "linear", "doubleLinear", "radial"};
+static const char* curveNames[] = {"linear", "cosinus2", "sigmoid", "cosinus", "cos2sqrt",
+                                   "power2", "cos2power2", "power3", "undulate", "undulate2", "undulate3"};
+
+template <typename Fill>
+static double BestTime(const int &repeats, Mat &img, const Mat &background, Fill fill) // best time of several runs, in milliseconds
+{
+    double best = -1;
+    for (int n = 0; n < repeats; n++) {
+        background.copyTo(img); // same start for each run
+        int64 start = getTickCount();
+        fill();
+        double elapsed = double(getTickCount() - start) * 1000.0 / getTickFrequency();
+        if ((best < 0) || (elapsed < best))
+            best = elapsed;
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    int width = (argc > 1) ? atoi(argv[1]) : 1920;
+    int height = (argc > 2) ? atoi(argv[2]) : 1080;
+    int threads = (argc > 3) ? atoi(argv[3]) : 1; // 1 thread by default : compare the kernels, not the cores
+    int repeats = (argc > 4) ? atoi(argv[4]) : 5;
+
+    setNumThreads(threads);
+
+    // a label covering about half of the image, like a big segmentation area
+    Mat mask = Mat::zeros(height, width, CV_8UC1);
+    ellipse(mask, Point(width / 2, height / 2), Size(width * 2 / 5, height * 2 / 5), 0, 0, 360, Scalar(255), -1);
+    Mat labels;
+    mask.convertTo(labels, CV_16U);
+    labelRunsIndex runsIndex = IndexLabelRuns(labels);
+    const labelRuns &runs = runsIndex[255];
+
+    Mat background = Mat::zeros(height, width, CV_8UC1);
+    Mat img;
+
+    Point beginPoint(width / 5, height / 4);
+    Point endPoint(width * 3 / 4, height * 4 / 5);
+    int beginColor = 32;
+    int endColor = 224;
+
+    std::cout << "gray gradients " << width << "x" << height << ", " << threads << " thread(s), best of " << repeats
+              << " runs, in ms" << std::endl << std::endl;
+    std::cout << std::left << std::setw(14) << "gradient" << std::setw(12) << "curve"
+              << std::right << std::setw(10) << "old" << std::setw(10) << "mask" << std::setw(10) << "runs"
+              << std::setw(10) << "old/mask" << std::setw(10) << "old/runs" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    double totalOld = 0, totalMask = 0, totalRuns = 0;
+    for (int type = gradient_flat; type <= gradient_radial; type++)
+        for (int curve = curve_linear; curve <= curve_undulate3; curve++) {
+            double timeOld = BestTime(repeats, img, background, [&]() {
+                ReferenceGradientFillGray(type, img, mask, beginPoint, endPoint, beginColor, endColor, curve); });
+            double timeMask = BestTime(repeats, img, background, [&]() {
+                GradientFillGray(type, img, mask, beginPoint, endPoint, beginColor, endColor, curve); });
+            double timeRuns = BestTime(repeats, img, background, [&]() {
+                GradientFillGray(type, img, runs, beginPoint, endPoint, beginColor, endColor, curve); });
+
+            totalOld += timeOld;
+            totalMask += timeMask;
+            totalRuns += timeRuns;
+
+            std::cout << std::left << std::setw(14) << gradientNames[type] << std::setw(12) << curveNames[curve]
+                      << std::right << std::setw(10) << timeOld << std::setw(10) << timeMask << std::setw(10) << timeRuns
+                      << std::setw(9) << timeOld / std::max(timeMask, 0.001) << "x"
+                      << std::setw(9) << timeOld / std::max(timeRuns, 0.001) << "x" << std::endl;
+        }
+
+    std::cout << std::endl << std::left << std::setw(26) << "total"
+              << std::right << std::setw(10) << totalOld << std::setw(10) << totalMask << std::setw(10) << totalRuns
+              << std::setw(9) << totalOld / std::max(totalMask, 0.001) << "x"
+              << std::setw(9) << totalOld / std::max(totalRuns, 0.001) << "x" << std::endl;
+
+    return 0;
+}
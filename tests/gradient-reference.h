@@ -0,0 +1,158 @@
+/*#-------------------------------------------------
+#
+#       Reference gray gradients for the checks
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * GradientFillGray as it was before the row kernels :
+#     - one switch on the gradient type per call
+#     - GrayCurve computed for each pixel, switch on the curve type
+#     - double linear gradient in two passes, the second one with the inverted vector
+#
+# * Only used by the checks and benchmarks, never by the application
+#
+#-------------------------------------------------*/
+
+#ifndef GRADIENTREFERENCE_H
+#define GRADIENTREFERENCE_H
+
+#include <QPixmap>
+
+#include "opencv2/opencv.hpp"
+
+#include "mat-image-tools.h"
+
+static double ReferenceGrayCurve(const int &color, const int &type, const int &begin, const int &range) // return a value transformed by a function
+{
+    double x = double(color-begin) / range; // x of f(x)
+
+    if (range == 0) return color; // faster this way
+
+    switch (type) {
+        // good spread
+        case curve_linear: return color; // linear -> the same color !
+        // S-shaped
+        case curve_cosinus2: return pow(cos(Pi / 2 - x * Pi/2), 2) * range + begin; // cosinus²
+        case curve_sigmoid: return 1.0 / (1 + exp(-5 * (2* (x) - 1))) * range + begin; // sigmoid
+        // fast beginning
+        case curve_cosinus: return cos(Pi / 2 - x * Pi/2) * range + begin; // cosinus
+        case curve_cos2sqrt: return pow(cos(Pi/2 - sqrt(x) * Pi/2), 2) * range + begin; // cos²sqrt
+        // fast ending
+        case curve_power2: return pow(x, 2) * range + begin; // power2
+        case curve_cos2power2: return pow(cos(Pi/2 - pow(x, 2) * Pi/2), 2) * range + begin; // cos²power2
+        case curve_power3: return pow(x, 3) * range + begin; // power3
+        // undulate
+        case curve_undulate: return cos(double(color-begin) / 4 * Pi) * range + begin; // undulate
+        case curve_undulate2: return cos(pow(double(color-begin) * 2 * Pi/2 + 0.5, 2)) * range + begin; // undulate²
+        case curve_undulate3: return (cos(Pi*Pi*pow(x+2.085,2))/(pow(x+2.085,3)+8)+(x+2.085)-2.11) * range + begin; // undulate3
+    }
+
+    return color;
+}
+
+static float ReferenceEuclideanDistance(cv::Point center, cv::Point point, int radius) // return distance between 2 points
+{
+    float distance = sqrt(std::pow(center.x - point.x, 2) + std::pow(center.y - point.y, 2));
+
+    if (distance > radius) return radius; // no value beyond radius
+        else return distance;
+}
+
+static inline uchar ReferenceGray(const float &color) // gray level stored by the old code : the float went to the 8-bit pixel through an int
+{
+    return uchar(int(color));
+}
+
+static void ReferenceGradientFillGray(const int &gradient_type, cv::Mat &img, const cv::Mat &msk, const cv::Point &beginPoint,
+                                      const cv::Point &endPoint, const int &beginColor, const int &endColor,
+                                      const int &curve, cv::Rect area = cv::Rect(0, 0, 0, 0)) // fill a 1-channel image with the mask converted to gray gradients, the old way
+{
+    if (area == cv::Rect(0, 0, 0, 0)) // default area = 0
+        area = cv::Rect(0,0, img.cols, img.rows); // set it to image dimensions
+
+    switch (gradient_type) {
+        case (gradient_flat): { // flat = same color everywhere
+            img(area).setTo(beginColor, msk(area)); // fill the mask with this color
+            return;
+        }
+        case (gradient_linear): { // grayscale is spread along the line
+            int A = (endPoint.x - beginPoint.x); // horizontal difference
+            int B = (endPoint.y - beginPoint.y); // vertical difference
+            int C1 = A * beginPoint.x + B * beginPoint.y; // sort of euclidian distance
+            int C2 = A * endPoint.x + B * endPoint.y;
+
+            float CO; // will contain color values
+
+            for (int row = area.y; row < area.y + area.height; row++) // scan mask
+                for (int col = area.x; col < area.x + area.width; col++)
+                    if (msk.at<uchar>(row, col) != 0) { // non-zero pixel in mask
+                        int C = A * col + B * row; // "distance" for this pixel
+
+                        if (C <= C1) CO = beginColor; // before begin point : begin color
+                            else if (C >= C2) CO = endColor; // after end point : end color
+                                else CO = round(ReferenceGrayCurve(float(beginColor * (C2 - C) + endColor * (C - C1))/(C2 - C1),
+                                                                   curve, beginColor, endColor - beginColor));
+                        img.at<uchar>(row, col) = ReferenceGray(CO);
+                    }
+            return;
+        }
+        case (gradient_doubleLinear): { // double linear = 2 times linear, just invert the vector the second time
+            int A = (endPoint.x - beginPoint.x); // same as linear
+            int B = (endPoint.y - beginPoint.y);
+            int C1 = A * beginPoint.x + B * beginPoint.y;
+            int C2 = A * endPoint.x + B * endPoint.y;
+
+            float CO;
+
+            for (int row = area.y; row < area.y + area.height; row++)
+                for (int col = area.x; col < area.x + area.width; col++)
+                    if (msk.at<uchar>(row, col) != 0) {
+                        int C = A * col + B * row;
+                        if (((C > C1) & (C < C2)) | (C >= C2) | (C == C1))  { // don't fill "before" the begin point
+                            if (C == C1) CO = beginColor;
+                                else if (C >= C2) CO = endColor;
+                                    else CO = round(ReferenceGrayCurve(float(beginColor * (C2 - C) + endColor * (C - C1))/(C2 - C1),
+                                                                       curve, beginColor, endColor - beginColor));
+                            img.at<uchar>(row, col) = ReferenceGray(CO);
+                        }
+                    }
+
+            cv::Point newEndPoint; // invert the vector
+            newEndPoint.x = 2* beginPoint.x - endPoint.x;
+            newEndPoint.y = 2* beginPoint.y - endPoint.y;
+
+            A = (newEndPoint.x - beginPoint.x); // same as before, but with new inverted vector
+            B = (newEndPoint.y - beginPoint.y);
+            C1 = A * beginPoint.x + B * beginPoint.y;
+            C2 = A * newEndPoint.x + B * newEndPoint.y;
+
+            for (int row = area.y; row < area.y + area.height; row++)
+                for (int col = area.x; col < area.x + area.width; col++)
+                    if (msk.at<uchar>(row, col) != 0) {
+                        int C = A * col + B * row;
+                        if (((C > C1) & (C < C2)) | (C >= C2) | (C == C1)) { // once again don't fill "before" begin point
+                            if (C == C1) CO = beginColor;
+                                else if (C >= C2) CO = endColor;
+                                    else CO = round(ReferenceGrayCurve(float(beginColor * (C2 - C) + endColor * (C - C1))/(C2 - C1),
+                                                                       curve, beginColor, endColor - beginColor));
+                            img.at<uchar>(row, col) = ReferenceGray(CO);
+                        }
+                    }
+            return;
+        }
+        case (gradient_radial): { // radial = concentric circles
+            float radius = std::sqrt(std::pow(beginPoint.x - endPoint.x, 2) + std::pow(beginPoint.y - endPoint.y, 2)); // maximum euclidian distance = vector length
+
+            for (int row = area.y; row < area.y + area.height; row++) // scan entire mask
+                for (int col = area.x; col < area.x + area.width; col++)
+                    if (msk.at<uchar>(row, col) != 0) { // non-zero pixel in mask
+                        float CO = round(ReferenceGrayCurve(beginColor + ReferenceEuclideanDistance(beginPoint, cv::Point(col, row), radius) / radius * (endColor - beginColor),
+                                                            curve, beginColor, endColor - beginColor)); // distance percentage, "shaped" by gray curve
+                        img.at<uchar>(row, col) = ReferenceGray(CO);
+                    }
+            return;
+        }
+    }
+}
+
+#endif // GRADIENTREFERENCE_H
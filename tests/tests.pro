@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+#     Checks and benchmarks of the image tools
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS +=  double-linear-check \
+            gradient-bench \
+            text-export-check
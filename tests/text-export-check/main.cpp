@@ -0,0 +1,158 @@
+/*#-------------------------------------------------
+#
+#     ASCII mesh exports : parallel writer check
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * SaveToObj and SaveToPly (ascii) format blocks of rows in parallel, with lookup tables for depths and colors
+#
+# * Compared byte by byte with the old serial QTextStream writers, on random depthmaps and images :
+#     - several sizes, depth scales and mesh errors (full resolution and adaptive meshes)
+#     - several threads, so that blocks are formatted at the same time
+#     - one very wide row, for the coordinates written in scientific notation
+#
+# * The triangles of the reference are read from the binary .ply export of the same mesh
+#
+# * Returns 0 if all files are the same, 1 otherwise
+#
+#-------------------------------------------------*/
+
+#include <QApplication>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <iostream>
+
+#include "opencv2/opencv.hpp"
+
+#include "openglwidget.h"
+#include "../text-export-reference.h"
+
+using namespace cv;
+
+static bool ReadPlyTriangles(const QString &filename, const int &vertices, std::vector<referenceTriangle> &triangles) // faces of a binary .ply export
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+
+    int headerEnd = data.indexOf("end_header\n");
+    int faceLine = data.indexOf("element face ");
+    if ((headerEnd < 0) || (faceLine < 0))
+        return false;
+    int faces = data.mid(faceLine + 13, data.indexOf('\n', faceLine) - faceLine - 13).toInt();
+
+    const int vertexSize = 3 * 4 + 3; // float x y z, uchar r g b
+    const int faceSize = 1 + 3 * 4; // uchar count, int indexes
+    const char* face = data.constData() + headerEnd + 11 + vertices * vertexSize;
+    if (face + faces * faceSize != data.constData() + data.size())
+        return false;
+
+    triangles.resize(faces);
+    for (int n = 0; n < faces; n++, face += faceSize) {
+        triangles[n].a = qFromLittleEndian<qint32>(face + 1);
+        triangles[n].b = qFromLittleEndian<qint32>(face + 5);
+        triangles[n].c = qFromLittleEndian<qint32>(face + 9);
+    }
+
+    return true;
+}
+
+static bool SameFiles(const QString &name, const QString &reference, const QString &written) // compare two files byte by byte, and tell where they differ
+{
+    QFile fileReference(reference), fileWritten(written);
+    if ((!fileReference.open(QIODevice::ReadOnly)) || (!fileWritten.open(QIODevice::ReadOnly))) {
+        std::cout << name.toStdString() << " : file missing" << std::endl;
+        return false;
+    }
+    QByteArray dataReference = fileReference.readAll();
+    QByteArray dataWritten = fileWritten.readAll();
+    if (dataReference == dataWritten)
+        return true;
+
+    int offset = 0;
+    while ((offset < dataReference.size()) && (offset < dataWritten.size()) && (dataReference[offset] == dataWritten[offset]))
+        offset++;
+    int lineStart = dataReference.lastIndexOf('\n', offset - 1) + 1;
+    std::cout << name.toStdString() << " : " << dataReference.size() << " bytes expected, " << dataWritten.size()
+              << " written, first difference at byte " << offset << std::endl
+              << "  expected : " << dataReference.mid(lineStart, dataReference.indexOf('\n', offset) - lineStart).toStdString() << std::endl
+              << "  written  : " << dataWritten.mid(lineStart, dataWritten.indexOf('\n', offset) - lineStart).toStdString() << std::endl;
+
+    return false;
+}
+
+static Mat RandomDepthmap(RNG &rng, const int &rows, const int &cols) // noise, flat areas and ramps, so that adaptive meshes are simplified
+{
+    Mat depthmap(rows, cols, CV_8UC1);
+    randu(depthmap, Scalar(0), Scalar(256)); // every gray level
+    for (int row = 0; row < rows / 2; row++) { // top half : linear ramps
+        uchar* depth = depthmap.ptr<uchar>(row);
+        for (int col = 0; col < cols; col++)
+            depth[col] = (row + col) % 256;
+    }
+    if (cols > 4)
+        depthmap(Rect(cols / 4, rows / 2, cols / 2, rows - rows / 2)).setTo(rng.uniform(0, 256)); // flat area
+
+    return depthmap;
+}
+
+int main(int argc, char *argv[])
+{
+    qputenv("QT_QPA_PLATFORM", "offscreen"); // no window is shown
+    QApplication app(argc, argv);
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        std::cout << "no temporary directory" << std::endl;
+        return 1;
+    }
+
+    setNumThreads(std::max(getNumThreads(), 4)); // blocks of rows formatted at the same time
+    RNG rng(20190708);
+
+    const Size sizes[] = {Size(1, 1), Size(3, 2), Size(160, 120), Size(257, 190), Size(1024, 40), Size(40, 1024)};
+    const double depths[] = {1.0, 0.37, 3.3, -2.5}; // depth scales of the 3D view
+    const double errors[] = {0, 2, 8}; // full resolution and adaptive meshes
+
+    int checks = 0, failures = 0;
+    auto check = [&](const Size &size, const double &depth, const double &error) {
+        openGLWidget widget;
+        widget.depthmap3D = RandomDepthmap(rng, size.height, size.width);
+        widget.image3D = Mat(size.height, size.width, CV_8UC3);
+        randu(widget.image3D, Scalar(0, 0, 0), Scalar(256, 256, 256));
+        widget.depth3D = depth;
+        widget.meshError3D = error;
+
+        QString name = QString("%1x%2-depth%3-error%4").arg(size.width).arg(size.height).arg(depth).arg(error);
+        QString base = dir.filePath(name);
+
+        std::vector<referenceTriangle> triangles;
+        if ((!widget.SaveToPly(base + "-binary.ply", true))
+                || (!ReadPlyTriangles(base + "-binary.ply", size.width * size.height, triangles))) {
+            std::cout << name.toStdString() << " : binary .ply not readable" << std::endl;
+            failures++;
+            return;
+        }
+
+        widget.SaveToObj(base + ".obj");
+        ReferenceSaveToObj(base + "-reference.obj", widget.depthmap3D, widget.image3D, depth, triangles);
+        widget.SaveToPly(base + ".ply", false);
+        ReferenceSaveToPly(base + "-reference.ply", widget.depthmap3D, widget.image3D, depth, triangles);
+
+        checks += 2;
+        failures += !SameFiles(name + ".obj", base + "-reference.obj", base + ".obj");
+        failures += !SameFiles(name + ".ply", base + "-reference.ply", base + ".ply");
+        for (const QString &file : {base + "-binary.ply", base + "-reference.obj", base + ".obj", base + "-reference.ply", base + ".ply"})
+            QFile::remove(file); // big files are not kept
+    };
+
+    for (const Size &size : sizes)
+        for (const double &depth : depths)
+            for (const double &error : errors)
+                check(size, depth, error);
+    check(Size(2000004, 1), 1.0, 0); // x coordinates past 1000000 : written in scientific notation, like QTextStream
+
+    std::cout << checks - failures << " / " << checks << " ascii exports identical to the serial writer" << std::endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+#     ASCII mesh exports : parallel writer check
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+#-------------------------------------------------
+
+QT       += core gui opengl
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = text-export-check
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES +=  main.cpp \
+            ../../openglwidget.cpp \
+            ../../mat-image-tools.cpp
+
+HEADERS  += ../../openglwidget.h \
+            ../../mat-image-tools.h \
+            ../text-export-reference.h
+
+# we add the package opencv to pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv4
+
+QMAKE_CXXFLAGS += -std=c++11
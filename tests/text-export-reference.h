@@ -0,0 +1,114 @@
+/*#-------------------------------------------------
+#
+#       Reference text exports for the checks
+#
+#    part of segmentation-depthmap-3d-opencv
+#
+# * ASCII .obj and .ply exports as they were before the parallel writer :
+#     - one QTextStream for the whole file, numbers formatted one at a time
+#     - .obj : every number written as a float by the stream
+#     - .ply : every number formatted by std::to_string
+#
+# * The triangles are given : they come from the mesh of the export being checked
+#
+# * Only used by the checks, never by the application
+#
+#-------------------------------------------------*/
+
+#ifndef TEXTEXPORTREFERENCE_H
+#define TEXTEXPORTREFERENCE_H
+
+#include <QFile>
+#include <QTextStream>
+
+#include "opencv2/opencv.hpp"
+
+struct referenceTriangle { // vertex indexes of one triangle, from 0
+    unsigned int a, b, c;
+};
+
+static void ReferenceSaveToObj(const QString &filename, const cv::Mat &depthmap3D, const cv::Mat &image3D, const double &depth3D,
+                               const std::vector<referenceTriangle> &triangles) // WaveFront .obj file, the old way
+{
+    QFile file(filename);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        QTextStream stream(&file);
+
+        // save vertices, centered like the 3D view
+        int halfX = -depthmap3D.cols / 2; // to center the axes in middle of image
+        int halfY = depthmap3D.rows / 2;
+
+        for (int row = 0; row < depthmap3D.rows; row++) { // for each row of the image
+            const uchar* depth = depthmap3D.ptr<uchar>(row);
+            const cv::Vec3b* pixel = image3D.ptr<cv::Vec3b>(row);
+            for (int col = 0; col < depthmap3D.cols; col++) { // for each pixel in the row from left to right
+                stream << "v " << float(col + halfX) << " " << float(-row + halfY) << " " << float((depth[col] - 127) * depth3D)
+                       << " " << float(pixel[col][2] / 255.0) << " " << float(pixel[col][1] / 255.0) << " " << float(pixel[col][0] / 255.0)
+                       << "\n";
+            }
+        }
+
+        // save indexes
+        for (size_t n = 0; n < triangles.size(); n++)
+            stream << "f " << triangles[n].a+1 << " " << triangles[n].b+1 << " " << triangles[n].c+1 << "\n";
+
+        stream.flush();
+        file.close();
+    }
+}
+
+static void ReferenceSaveToPly(const QString &filename, const cv::Mat &depthmap3D, const cv::Mat &image3D, const double &depth3D,
+                               const std::vector<referenceTriangle> &triangles) // ascii Polygon File Format .ply file, the old way
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) // replace previous file
+        return;
+
+    //// header, the same as the export
+    QByteArray header;
+    header += "ply\n";
+    header += "format ascii 1.0\n";
+    header += "comment Produced by a tool from AbsurdePhoton\n";
+    header += "comment GitHub: https://github.com/AbsurdePhoton\n";
+    header += "comment My photography site: absurdephoton.fr\n";
+    header += "element vertex " + QByteArray::number(image3D.rows * image3D.cols) + "\n";
+    header += "property float x\n";
+    header += "property float y\n";
+    header += "property float z\n";
+    header += "property uchar red\n";
+    header += "property uchar green\n";
+    header += "property uchar blue\n";
+    header += "element face " + QByteArray::number(int(triangles.size())) + "\n";
+    header += "property list uchar int vertex_index\n";
+    header += "end_header\n";
+    file.write(header);
+
+    //// ascii
+    QTextStream stream(&file);
+
+    //// save vertices
+    std::string st; // used to get a comma separator for floats, streams use locales !
+
+    for (int row = 0; row < image3D.rows; row++) { // for each row of area
+        const uchar* depth = depthmap3D.ptr<uchar>(row);
+        const cv::Vec3b* pixel = image3D.ptr<cv::Vec3b>(row);
+        for (int col = 0; col < image3D.cols; col++) { // for each pixel in the row from left to right
+                st = std::to_string(col) + " " + std::to_string(-row) + " " + std::to_string(float((depth[col] - 127) * depth3D))
+                        + " " + std::to_string(int(pixel[col][2])) + " " + std::to_string(int(pixel[col][1])) + " " + std::to_string(int(pixel[col][0]))
+                        + "\n";
+                stream << QString::fromStdString(st);
+        }
+    }
+
+    // save faces + indexes
+    for (size_t n = 0; n < triangles.size(); n++)
+        stream << "3 " << triangles[n].a << " " << triangles[n].b << " " << triangles[n].c << "\n";
+
+    // Close the file
+    stream << "\n";
+    stream.flush();
+    file.close();
+}
+
+#endif // TEXTEXPORTREFERENCE_H